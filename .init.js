@@ -967,6 +967,69 @@ self.require = function(what) {
 
 })();
 
+// SharedChannel: single-producer/single-consumer byte message ring living in
+// a SharedArrayBuffer. Post `channel.buffer` to a Worker and wrap it there
+// with `new SharedChannel(buffer)`; messages then move between the isolates
+// without going through the serializer.
+function SharedChannel(buffer) {
+	if (typeof(buffer) == 'number') buffer = new SharedArrayBuffer(16 + buffer);
+	if (!(buffer instanceof SharedArrayBuffer) || buffer.byteLength <= 20) {
+		throw new Error("SharedChannel: expected a SharedArrayBuffer or a size");
+	}
+	this.buffer = buffer;
+	// [0] read offset, [1] write offset, [2] bytes in use
+	this._state = new Int32Array(buffer, 0, 4);
+	this._data = new Uint8Array(buffer, 16);
+	this.capacity = this._data.length;
+}
+
+SharedChannel.prototype._copyIn = function(pos, bytes) {
+	var first = Math.min(bytes.length, this.capacity - pos);
+	this._data.set(bytes.subarray(0, first), pos);
+	if (first < bytes.length) this._data.set(bytes.subarray(first), 0);
+	return (pos + bytes.length) % this.capacity;
+}
+
+SharedChannel.prototype._copyOut = function(pos, bytes) {
+	var first = Math.min(bytes.length, this.capacity - pos);
+	bytes.set(this._data.subarray(pos, pos + first));
+	if (first < bytes.length) bytes.set(this._data.subarray(0, bytes.length - first), first);
+	return (pos + bytes.length) % this.capacity;
+}
+
+// Returns false if there was no room for the message within timeout ms.
+SharedChannel.prototype.send = function(data, timeout) {
+	var bytes = data instanceof ArrayBuffer || data instanceof SharedArrayBuffer ? new Uint8Array(data) :
+		new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+	var need = 4 + bytes.length;
+	if (need > this.capacity) throw new Error("SharedChannel: message larger than channel");
+	var state = this._state;
+	var used;
+	while (this.capacity - (used = Atomics.load(state, 2)) < need) {
+		if (Atomics.wait(state, 2, used, timeout) == 'timed-out') return false;
+	}
+	var pos = this._copyIn(state[1], new Uint8Array(new Uint32Array([bytes.length]).buffer));
+	state[1] = this._copyIn(pos, bytes);
+	Atomics.add(state, 2, need);
+	Atomics.notify(state, 2);
+	return true;
+}
+
+// Returns the next message as an ArrayBuffer, or null after timeout ms.
+SharedChannel.prototype.receive = function(timeout) {
+	var state = this._state;
+	while (Atomics.load(state, 2) == 0) {
+		if (Atomics.wait(state, 2, 0, timeout) == 'timed-out') return null;
+	}
+	var len = new Uint32Array(1);
+	var pos = this._copyOut(state[0], new Uint8Array(len.buffer));
+	var bytes = new Uint8Array(len[0]);
+	state[0] = this._copyOut(pos, bytes);
+	Atomics.sub(state, 2, 4 + bytes.length);
+	Atomics.notify(state, 2);
+	return bytes.buffer;
+}
+
 if (typeof(process.mainModule)=='undefined') {
 	process.mainModule = '(tinn)';
 }
@@ -0,0 +1,319 @@
+/*
+Copyright (c) 2020 TINN by Saverio Castellano. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+
+/*
+ FastCGI load driver: talks to a FastCGI server (e.g. a TINN script calling
+ Http.openSocket on a UNIX socket path) directly, without a web server in
+ front, and reports throughput and latency percentiles. Each of the -c
+ threads sends requests one after the other, opening a new connection per
+ request like nginx does unless -k is given.
+
+   fcgi_bench -s /tmp/tinn.sock -n 100000 -c 50 -u /index.html [-k] [-j]
+
+ -j prints a single JSON line instead of the text report.
+*/
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_HEADER_LEN 8
+
+typedef struct {
+	const char * socketPath;
+	long requests;
+	int concurrency;
+	std::string uri;
+	std::string method;
+	bool keepAlive;
+	bool json;
+} BenchOptions;
+
+typedef struct {
+	std::vector<int64_t> latencies;	// microseconds
+	long failed;
+	long non2xx;
+	uint64_t bytes;
+} BenchResult;
+
+static int64_t nowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void putHeader(std::string &out, int type, int requestId, size_t contentLength)
+{
+	unsigned char h[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, (unsigned char)type,
+		(unsigned char)(requestId >> 8), (unsigned char)requestId,
+		(unsigned char)(contentLength >> 8), (unsigned char)contentLength,
+		0, 0
+	};
+	out.append((const char*)h, FCGI_HEADER_LEN);
+}
+
+static void putLength(std::string &out, size_t len)
+{
+	if (len < 128) {
+		out += (char)len;
+	} else {
+		out += (char)((len >> 24) | 0x80);
+		out += (char)(len >> 16);
+		out += (char)(len >> 8);
+		out += (char)len;
+	}
+}
+
+static void putParam(std::string &out, const std::string &name, const std::string &value)
+{
+	putLength(out, name.size());
+	putLength(out, value.size());
+	out += name;
+	out += value;
+}
+
+// the whole request (begin, params and an empty stdin) is built once and reused
+static std::string buildRequest(const BenchOptions &opts)
+{
+	std::string params;
+	std::string path = opts.uri;
+	std::string query;
+	size_t q = path.find('?');
+	if (q != std::string::npos) {
+		query = path.substr(q + 1);
+		path = path.substr(0, q);
+	}
+	putParam(params, "GATEWAY_INTERFACE", "CGI/1.1");
+	putParam(params, "SERVER_SOFTWARE", "fcgi_bench");
+	putParam(params, "SERVER_PROTOCOL", "HTTP/1.1");
+	putParam(params, "SERVER_NAME", "localhost");
+	putParam(params, "SERVER_PORT", "80");
+	putParam(params, "REMOTE_ADDR", "127.0.0.1");
+	putParam(params, "REQUEST_METHOD", opts.method);
+	putParam(params, "REQUEST_URI", opts.uri);
+	putParam(params, "DOCUMENT_URI", path);
+	putParam(params, "SCRIPT_NAME", path);
+	putParam(params, "QUERY_STRING", query);
+	putParam(params, "CONTENT_LENGTH", "0");
+	putParam(params, "HTTP_HOST", "localhost");
+
+	std::string req;
+	putHeader(req, FCGI_BEGIN_REQUEST, 1, 8);
+	unsigned char begin[8] = {0, FCGI_RESPONDER, (unsigned char)(opts.keepAlive ? FCGI_KEEP_CONN : 0), 0, 0, 0, 0, 0};
+	req.append((const char*)begin, 8);
+	for (size_t off = 0; off < params.size(); off += 65535) {
+		size_t len = std::min((size_t)65535, params.size() - off);
+		putHeader(req, FCGI_PARAMS, 1, len);
+		req.append(params, off, len);
+	}
+	putHeader(req, FCGI_PARAMS, 1, 0);
+	putHeader(req, FCGI_STDIN, 1, 0);
+	return req;
+}
+
+static int connectSocket(const char * path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool writeAll(int fd, const char * data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool readAll(int fd, char * data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = read(fd, data, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+// reads records up to FCGI_END_REQUEST; status is taken from the "Status:" header (200 when missing)
+static bool readResponse(int fd, std::vector<char> &buf, uint64_t &bytes, int &status)
+{
+	std::string head;
+	bool inHeaders = true;
+	status = 200;
+	for (;;) {
+		unsigned char h[FCGI_HEADER_LEN];
+		if (!readAll(fd, (char*)h, FCGI_HEADER_LEN)) return false;
+		size_t len = ((size_t)h[4] << 8) | h[5];
+		size_t total = len + h[6];
+		if (buf.size() < total) buf.resize(total);
+		if (total > 0 && !readAll(fd, buf.data(), total)) return false;
+		if (h[1] == FCGI_END_REQUEST) return true;
+		if (h[1] != FCGI_STDOUT) continue;
+		bytes += len;
+		if (inHeaders) {
+			head.append(buf.data(), std::min(len, (size_t)4096));
+			size_t end = head.find("\r\n\r\n");
+			if (end != std::string::npos || head.size() >= 4096) {
+				inHeaders = false;
+				size_t s = head.find("Status:");
+				if (s != std::string::npos && s < end) status = atoi(head.c_str() + s + 7);
+			}
+		}
+	}
+}
+
+static void runClient(const BenchOptions &opts, const std::string &request, std::atomic<long> &remaining, BenchResult &result)
+{
+	std::vector<char> buf(65536);
+	int fd = -1;
+	while (remaining.fetch_sub(1) > 0) {
+		int64_t start = nowMicros();
+		if (fd < 0) fd = connectSocket(opts.socketPath);
+		int status = 0;
+		bool ok = fd >= 0 && writeAll(fd, request.data(), request.size()) &&
+			readResponse(fd, buf, result.bytes, status);
+		if (!opts.keepAlive || !ok) {
+			if (fd >= 0) close(fd);
+			fd = -1;
+		}
+		if (!ok) {
+			result.failed++;
+			continue;
+		}
+		if (status < 200 || status > 299) result.non2xx++;
+		result.latencies.push_back(nowMicros() - start);
+	}
+	if (fd >= 0) close(fd);
+}
+
+static double percentile(const std::vector<int64_t> &sorted, double p)
+{
+	if (sorted.empty()) return 0;
+	size_t i = (size_t)(p * sorted.size());
+	if (i >= sorted.size()) i = sorted.size() - 1;
+	return sorted[i] / 1000.0;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: fcgi_bench -s socket_path [-n requests] [-c concurrency] [-u uri] [-m method] [-k] [-j]\n");
+	exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+	BenchOptions opts;
+	opts.socketPath = NULL;
+	opts.requests = 10000;
+	opts.concurrency = 1;
+	opts.uri = "/";
+	opts.method = "GET";
+	opts.keepAlive = false;
+	opts.json = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-s" && hasValue) opts.socketPath = argv[++i];
+		else if (arg == "-n" && hasValue) opts.requests = atol(argv[++i]);
+		else if (arg == "-c" && hasValue) opts.concurrency = atoi(argv[++i]);
+		else if (arg == "-u" && hasValue) opts.uri = argv[++i];
+		else if (arg == "-m" && hasValue) opts.method = argv[++i];
+		else if (arg == "-k") opts.keepAlive = true;
+		else if (arg == "-j") opts.json = true;
+		else usage();
+	}
+	if (opts.socketPath == NULL || opts.requests <= 0 || opts.concurrency <= 0) usage();
+
+	std::string request = buildRequest(opts);
+	std::atomic<long> remaining(opts.requests);
+	std::vector<BenchResult> results(opts.concurrency);
+	std::vector<std::thread> threads;
+
+	int64_t start = nowMicros();
+	for (int i = 0; i < opts.concurrency; i++) {
+		results[i].failed = 0;
+		results[i].non2xx = 0;
+		results[i].bytes = 0;
+		threads.push_back(std::thread(runClient, std::cref(opts), std::cref(request), std::ref(remaining), std::ref(results[i])));
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	double secs = (nowMicros() - start) / 1e6;
+
+	std::vector<int64_t> all;
+	long failed = 0, non2xx = 0;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < results.size(); i++) {
+		all.insert(all.end(), results[i].latencies.begin(), results[i].latencies.end());
+		failed += results[i].failed;
+		non2xx += results[i].non2xx;
+		bytes += results[i].bytes;
+	}
+	std::sort(all.begin(), all.end());
+	double mean = 0;
+	for (size_t i = 0; i < all.size(); i++) mean += all[i];
+	mean = all.empty() ? 0 : mean / all.size() / 1000.0;
+	double rps = secs > 0 ? all.size() / secs : 0;
+
+	if (opts.json) {
+		printf("{\"uri\":\"%s\",\"requests\":%ld,\"concurrency\":%d,\"completed\":%lu,\"failed\":%ld,\"non2xx\":%ld,"
+			"\"bytes\":%llu,\"seconds\":%.3f,\"rps\":%.1f,\"meanMs\":%.3f,\"p50Ms\":%.3f,\"p90Ms\":%.3f,"
+			"\"p99Ms\":%.3f,\"p999Ms\":%.3f,\"maxMs\":%.3f}\n",
+			opts.uri.c_str(), opts.requests, opts.concurrency, (unsigned long)all.size(), failed, non2xx,
+			(unsigned long long)bytes, secs, rps, mean, percentile(all, 0.5), percentile(all, 0.9),
+			percentile(all, 0.99), percentile(all, 0.999), percentile(all, 1));
+	} else {
+		printf("URI:                %s\n", opts.uri.c_str());
+		printf("Concurrency Level:  %d\n", opts.concurrency);
+		printf("Time taken:         %.3f seconds\n", secs);
+		printf("Complete requests:  %lu\n", (unsigned long)all.size());
+		printf("Failed requests:    %ld\n", failed);
+		printf("Non-2xx responses:  %ld\n", non2xx);
+		printf("Bytes received:     %llu\n", (unsigned long long)bytes);
+		printf("Requests per second: %.1f\n", rps);
+		printf("Latency (ms):       mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+			mean, percentile(all, 0.5), percentile(all, 0.9), percentile(all, 0.99),
+			percentile(all, 0.999), percentile(all, 1));
+	}
+	return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2020 TINN by Saverio Castellano. All rights reserved.
+Use of this source code is governed by a BSD-style license that can be
+found in the LICENSE file.
+*/
+
+/*
+ Lets native modules record into the shell's Metrics registry (the JS
+ Metrics object). Call TinnMetricsInit() from the module's init(), register
+ metrics once with TinnMetric() and update them by id. When the entry points
+ are missing (older tinn executable) every call is a no-op.
+*/
+#ifndef TINN_METRICS_H
+#define TINN_METRICS_H
+
+#include <stdint.h>
+#include <chrono>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <dlfcn.h>
+#endif
+
+#define TINN_METRIC_COUNTER 0
+#define TINN_METRIC_GAUGE 1
+#define TINN_METRIC_HISTOGRAM 2
+
+typedef int (*TinnMetricsRegisterFunc)(const char* name, int kind);
+typedef void (*TinnMetricsUpdateFunc)(int id, int64_t value);
+
+static TinnMetricsRegisterFunc tinnMetricsRegister = NULL;
+static TinnMetricsUpdateFunc tinnMetricsAdd = NULL;
+static TinnMetricsUpdateFunc tinnMetricsSet = NULL;
+static TinnMetricsUpdateFunc tinnMetricsRecord = NULL;
+
+static void* TinnMetricsLookup(const char* name)
+{
+#if defined(_WIN32)
+	return (void*)GetProcAddress(GetModuleHandle(NULL), name);
+#else
+	return dlsym(RTLD_DEFAULT, name);
+#endif
+}
+
+static inline void TinnMetricsInit()
+{
+	tinnMetricsRegister = (TinnMetricsRegisterFunc)TinnMetricsLookup("tinn_MetricsRegister");
+	tinnMetricsAdd = (TinnMetricsUpdateFunc)TinnMetricsLookup("tinn_MetricsAdd");
+	tinnMetricsSet = (TinnMetricsUpdateFunc)TinnMetricsLookup("tinn_MetricsSet");
+	tinnMetricsRecord = (TinnMetricsUpdateFunc)TinnMetricsLookup("tinn_MetricsRecord");
+	if (!tinnMetricsAdd || !tinnMetricsSet || !tinnMetricsRecord) tinnMetricsRegister = NULL;
+}
+
+// returns -1 when metrics are not available, updates with id -1 are ignored
+static inline int TinnMetric(const char* name, int kind)
+{
+	return tinnMetricsRegister ? tinnMetricsRegister(name, kind) : -1;
+}
+
+static inline void TinnMetricAdd(int id, int64_t delta)
+{
+	if (id >= 0) tinnMetricsAdd(id, delta);
+}
+
+static inline void TinnMetricSet(int id, int64_t value)
+{
+	if (id >= 0) tinnMetricsSet(id, value);
+}
+
+static inline void TinnMetricRecord(int id, int64_t value)
+{
+	if (id >= 0) tinnMetricsRecord(id, value);
+}
+
+// monotonic clock in microseconds, for latency histograms
+static inline int64_t TinnMetricsNow()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// records the time between construction and destruction into a histogram
+class TinnMetricsTimer {
+public:
+	explicit TinnMetricsTimer(int id) : id_(id), start_(id >= 0 ? TinnMetricsNow() : 0) {}
+	~TinnMetricsTimer() { if (id_ >= 0) tinnMetricsRecord(id_, TinnMetricsNow() - start_); }
+private:
+	int id_;
+	int64_t start_;
+};
+
+#endif
@@ -13,9 +13,16 @@ found in the LICENSE file.
 #include <stdlib.h>
 #include <istream>
 #include <fstream>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
 
 #include "v8adapt.h"		
+#include "tinn_metrics.h"
 
 
 using std::ifstream;
@@ -44,7 +51,20 @@ typedef struct {
 	FCGX_Request * request;
 	CURL * curl;
 	bool served;
+	int64_t acceptedAt;	// set while a request is being handled, for the handler time
 } HttpContext;
+
+// Metrics ids, registered in init()
+static int metricAcceptWait = -1;
+static int metricRequests = -1;
+static int metricInFlight = -1;
+static int metricHandler = -1;
+static int metricRequestBody = -1;
+static int metricRequestBodyBytes = -1;
+static int metricServeFile = -1;
+static int metricFinish = -1;
+static int metricClientRequest = -1;
+static int metricClientErrors = -1;
  
 
 int isFileReadable(char * file)
@@ -111,6 +131,7 @@ static void HttpGetRequestBody(const v8::FunctionCallbackInfo<v8::Value>& args)
     return;
   }
   FCGX_Request* request = ctx->request;
+  TinnMetricsTimer timer(metricRequestBody);
 	
     char * content_length_str = FCGX_GetParam("CONTENT_LENGTH", request->envp);
 
@@ -141,6 +162,7 @@ static void HttpGetRequestBody(const v8::FunctionCallbackInfo<v8::Value>& args)
 		content = sdscatlen(content, buf, bytesRead);
 		
 	} while(bytesRead > 0 && sdslen(content) < content_length);
+	TinnMetricAdd(metricRequestBodyBytes, sdslen(content));
 	
 	args.GetReturnValue().Set(v8::String::NewFromUtf8(isolate, content)TO_LOCAL_CHECKED);
 	sdsfree(content);
@@ -199,8 +221,23 @@ static void HttpAccept(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	}
 	
 	FCGX_Request* request = ctx->request;
-	FCGX_Accept_r(request);
-
+	ctx->served = false;
+	if (ctx->acceptedAt) {
+		// the previous request was never finished
+		TinnMetricAdd(metricInFlight, -1);
+		ctx->acceptedAt = 0;
+	}
+	// returns false once the socket has been closed (Http.closeSocket)
+	int64_t start = TinnMetricsNow();
+	if (FCGX_Accept_r(request) < 0) {
+		args.GetReturnValue().Set(false);
+		return;
+	}
+	ctx->acceptedAt = TinnMetricsNow();
+	TinnMetricRecord(metricAcceptWait, ctx->acceptedAt - start);
+	TinnMetricAdd(metricRequests, 1);
+	TinnMetricAdd(metricInFlight, 1);
+	args.GetReturnValue().Set(true);
 }
 
 static void HttpGetParams(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -240,7 +277,14 @@ static void HttpFinish(const v8::FunctionCallbackInfo<v8::Value>& args) {
     return;
   }
   FCGX_Request* request = ctx->request;
+  int64_t start = TinnMetricsNow();
+  if (ctx->acceptedAt) {
+	  TinnMetricRecord(metricHandler, start - ctx->acceptedAt);
+	  TinnMetricAdd(metricInFlight, -1);
+	  ctx->acceptedAt = 0;
+  }
   FCGX_Finish_r(request);		
+  TinnMetricRecord(metricFinish, TinnMetricsNow() - start);
 }
 
 static void HttpPrint(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -299,29 +343,200 @@ static void HttpOpenSocket(const v8::FunctionCallbackInfo<v8::Value>& args) {
   }
 }
 
-static char* ReadChars(Isolate* isolate, const char* name, int* size_out) {
-  FILE* file = fopen(name, "rb");
-  if (file == NULL) return NULL;
-
-  fseek(file, 0, SEEK_END);
-  size_t size = ftell(file);
-  rewind(file);
-
-  char* chars = new char[size + 1];
-  chars[size] = '\0';
-  for (size_t i = 0; i < size;) {
-    i += fread(&chars[i], 1, size - i, file);
-    if (ferror(file)) {
-      fclose(file);
-      delete[] chars;
-      return nullptr;
-    }
-  }
-  fclose(file);
-  *size_out = static_cast<int>(size);
-  return chars;
+/*
+ File cache used by Http.serveFile. It is shared by all the isolates (Workers)
+ of the process: small files are kept in memory together with their response
+ headers and revalidated against the file mtime/size on every request. Larger
+ files are not cached, they are streamed in chunks from a handle that stays
+ open for the whole response.
+*/
+static const size_t FILE_CACHE_CHUNK = 64 * 1024;
+
+typedef struct FileCacheEntry {
+	std::string key;
+	std::string etag;
+	std::string lastModified;
+	std::string headers;	// pre-built "200 OK" headers, ends with the empty line
+	std::string response;	// headers + body for in-memory entries, empty for streamed files
+	time_t mtime;
+	off_t size;
+	std::list<std::shared_ptr<FileCacheEntry> >::iterator lru;
+
+	FileCacheEntry() : mtime(0), size(0) {}
+} FileCacheEntry;
+
+typedef std::shared_ptr<FileCacheEntry> FileCacheEntryPtr;
+
+static std::mutex fileCacheMutex;
+static std::list<FileCacheEntryPtr> fileCacheLru;
+static std::unordered_map<std::string, FileCacheEntryPtr> fileCacheMap;
+static size_t fileCacheMemBytes = 0;
+static size_t fileCacheMaxBytes = 64 * 1024 * 1024;
+static std::atomic<size_t> fileCacheMaxFileSize(256 * 1024);	// read by serveFile without the lock
+static size_t fileCacheMaxEntries = 4096;
+
+static std::atomic<uint64_t> fileCacheHits(0);
+static std::atomic<uint64_t> fileCacheMisses(0);
+static std::atomic<uint64_t> fileCacheNotModified(0);
+static std::atomic<uint64_t> fileCacheBytesServed(0);
+static std::atomic<uint64_t> fileCacheStreamed(0);
+static std::atomic<uint64_t> fileCacheStreamErrors(0);
+
+static void FileCacheRemoveLocked(FileCacheEntryPtr entry)
+{
+	fileCacheMemBytes -= entry->response.size();
+	fileCacheLru.erase(entry->lru);
+	fileCacheMap.erase(entry->key);
 }
 
+static void FileCacheEvictLocked()
+{
+	while (!fileCacheLru.empty() && 
+		(fileCacheMemBytes > fileCacheMaxBytes || fileCacheMap.size() > fileCacheMaxEntries))
+	{
+		FileCacheRemoveLocked(fileCacheLru.back());
+	}
+}
+
+static void FileCacheHttpDate(time_t t, char * buf, size_t len)
+{
+	struct tm tm;
+#ifdef _WIN32
+	gmtime_s(&tm, &t);
+#else
+	gmtime_r(&t, &tm);
+#endif
+	strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// a short read means the file changed after fstat, the caller treats it as an error
+static bool FileCacheReadBody(FILE* file, size_t size, std::string &out)
+{
+	size_t offset = out.size();
+	out.resize(offset + size);
+	size_t i = 0;
+	while (i < size) {
+		size_t n = fread(&out[offset + i], 1, size - i, file);
+		if (n == 0) break;
+		i += n;
+	}
+	return i == size;
+}
+
+// files up to maxFileSize are read into memory, larger ones only get their headers
+static FileCacheEntryPtr FileCacheLoad(FILE* file, const char * mimeType, const std::string &key, struct stat &s, size_t maxFileSize)
+{
+	FileCacheEntryPtr entry = std::make_shared<FileCacheEntry>();
+	entry->key = key;
+	entry->mtime = s.st_mtime;
+	entry->size = s.st_size;
+	
+	char buf[128];
+	snprintf(buf, sizeof(buf), "\"%llx-%llx\"", (unsigned long long)s.st_mtime, (unsigned long long)s.st_size);
+	entry->etag = buf;
+	FileCacheHttpDate(s.st_mtime, buf, sizeof(buf));
+	entry->lastModified = buf;
+	
+	entry->headers = "Status: 200 OK\r\nContent-type: ";
+	entry->headers += mimeType;
+	snprintf(buf, sizeof(buf), "\r\nContent-Length: %llu\r\n", (unsigned long long)s.st_size);
+	entry->headers += buf;
+	entry->headers += "ETag: " + entry->etag + "\r\n";
+	entry->headers += "Last-Modified: " + entry->lastModified + "\r\n\r\n";
+	
+	if ((size_t)s.st_size <= maxFileSize) {
+		entry->response.reserve(entry->headers.size() + s.st_size);
+		entry->response = entry->headers;
+		if (!FileCacheReadBody(file, s.st_size, entry->response)) return FileCacheEntryPtr();
+	}
+	return entry;
+}
+
+/*
+ Returns the cached entry when it is still fresh. Otherwise the file is opened
+ and *file is set (the caller closes it): s is refreshed with fstat on that
+ handle, small files are read and cached, large ones are returned uncached
+ and must be streamed from *file.
+*/
+static FileCacheEntryPtr FileCacheGet(const char * name, const char * mimeType, struct stat &s, FILE** file)
+{
+	std::string key(name);
+	key.push_back('\0');
+	key += mimeType;
+	*file = NULL;
+	size_t maxFileSize = fileCacheMaxFileSize.load();
+	
+	if ((size_t)s.st_size <= maxFileSize) {
+		std::lock_guard<std::mutex> lock(fileCacheMutex);
+		std::unordered_map<std::string, FileCacheEntryPtr>::iterator it = fileCacheMap.find(key);
+		if (it != fileCacheMap.end()) {
+			FileCacheEntryPtr entry = it->second;
+			if (entry->mtime == s.st_mtime && entry->size == s.st_size) {
+				fileCacheLru.splice(fileCacheLru.begin(), fileCacheLru, entry->lru);
+				fileCacheHits++;
+				return entry;
+			}
+			FileCacheRemoveLocked(entry);
+		}
+	}
+	
+	fileCacheMisses++;
+	*file = fopen(name, "rb");
+	if (*file == NULL) return FileCacheEntryPtr();
+	if (fstat(fileno(*file), &s) != 0 || (s.st_mode & S_IFDIR)) return FileCacheEntryPtr();
+	FileCacheEntryPtr entry = FileCacheLoad(*file, mimeType, key, s, maxFileSize);
+	if (!entry || entry->response.empty()) return entry;
+	
+	std::lock_guard<std::mutex> lock(fileCacheMutex);
+	std::unordered_map<std::string, FileCacheEntryPtr>::iterator it = fileCacheMap.find(key);
+	if (it != fileCacheMap.end()) FileCacheRemoveLocked(it->second);
+	fileCacheLru.push_front(entry);
+	entry->lru = fileCacheLru.begin();
+	fileCacheMap[key] = entry;
+	fileCacheMemBytes += entry->response.size();
+	FileCacheEvictLocked();
+	return entry;
+}
+
+static bool FileCacheNotModified(FCGX_Request* request, FileCacheEntryPtr &entry)
+{
+	char * inm = FCGX_GetParam("HTTP_IF_NONE_MATCH", request->envp);
+	if (inm) {
+		if (strcmp(inm, "*") == 0) return true;
+		const char * p = strstr(inm, entry->etag.c_str());
+		return p != NULL;
+	}
+	char * ims = FCGX_GetParam("HTTP_IF_MODIFIED_SINCE", request->envp);
+	return ims && entry->lastModified == ims;
+}
+
+static void FileCachePutChunked(FCGX_Request* request, const char * data, size_t size)
+{
+	while (size > 0) {
+		int n = (int)(size < FILE_CACHE_CHUNK ? size : FILE_CACHE_CHUNK);
+		if (FCGX_PutStr(data, n, request->out) < 0) return;
+		data += n;
+		size -= n;
+	}
+}
+
+// returns false when the file ends before size bytes (truncated while being served)
+static bool FileCacheStream(FCGX_Request* request, FILE* file, size_t size)
+{
+	char * buf = new char[FILE_CACHE_CHUNK];
+	while (size > 0) {
+		size_t n = fread(buf, 1, size < FILE_CACHE_CHUNK ? size : FILE_CACHE_CHUNK, file);
+		if (n == 0) break;
+		if (FCGX_PutStr(buf, (int)n, request->out) < 0) {
+			// client went away, nothing more to do
+			size = 0;
+			break;
+		}
+		size -= n;
+	}
+	delete[] buf;
+	return size == 0;
+}
 
 static void HttpServeFile(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
@@ -345,39 +560,127 @@ static void HttpServeFile(const v8::FunctionCallbackInfo<v8::Value>& args)
 		return;
 	}	
 	
+	TinnMetricsTimer timer(metricServeFile);
 	v8::String::Utf8Value jsFile(isolate,Handle<v8::String>::Cast(args[0]));
 	v8::String::Utf8Value jsMimeType(isolate,Handle<v8::String>::Cast(args[1]));
 	
-	int size = 0;
-	char* chars = ReadChars(isolate, *jsFile, &size);
-	if (chars == NULL) return ;
+	struct stat s;
+	if (stat(*jsFile, &s) != 0 || (s.st_mode & S_IFDIR)) {
+		args.GetReturnValue().Set(false);
+		return;
+	}
 	
+	FILE* file;
+	FileCacheEntryPtr entry = FileCacheGet(*jsFile, *jsMimeType, s, &file);
+	if (!entry) {
+		if (file) fclose(file);
+		args.GetReturnValue().Set(false);
+		return;
+	}
 	
     FCGX_Request* request = ctx->request;
-    
-	FCGX_PutS("Status: 200 OK\r\n", request->out);
-	char header[256]; 
-	sprintf(header, "Content-type: %s\r\n", *jsMimeType);
-	FCGX_PutS(header, request->out);
-	sprintf(header, "Content-Length: %d\r\n", size);
-	FCGX_PutS(header, request->out);
-	FCGX_PutS("\r\n", request->out);
-	
-    FCGX_PutS(chars, request->out);
-	delete[] chars;
- 	/*int bufsize = 500;	
-	char buf[500];
-	int read_bytes;
-	while (!ifs.eof() && size > 0)
-    {
-		ifs.read(buf, size < bufsize ? size : bufsize);
-		read_bytes = ifs.gcount();
-		size -= read_bytes;
-		FCGX_PutS(buf, request->out);
-		printf("puts: %s\n" , buf);
-	}*/
 	
+	if (FileCacheNotModified(request, entry)) {
+		if (file) fclose(file);
+		std::string headers = "Status: 304 Not Modified\r\nETag: " + entry->etag + 
+			"\r\nLast-Modified: " + entry->lastModified + "\r\n\r\n";
+		FCGX_PutStr(headers.data(), (int)headers.size(), request->out);
+		fileCacheNotModified++;
+		ctx->served = true;
+		args.GetReturnValue().Set(true);
+		return;
+	}
+	
+	char * method = FCGX_GetParam("REQUEST_METHOD", request->envp);
+	bool head = method && strcmp(method, "HEAD") == 0;
+	
+	bool complete = true;
+	if (!entry->response.empty()) {
+		size_t len = head ? entry->headers.size() : entry->response.size();
+		FileCachePutChunked(request, entry->response.data(), len);
+	} else {
+		FCGX_PutStr(entry->headers.data(), (int)entry->headers.size(), request->out);
+		if (!head) {
+			fileCacheStreamed++;
+			complete = FileCacheStream(request, file, entry->size);
+		}
+	}
+	if (file) fclose(file);
 	ctx->served = true;
+	if (!complete) {
+		// headers promised more bytes than the file has now, the response can't be completed
+		fileCacheStreamErrors++;
+		Throw(isolate, "file was truncated while being served");
+		return;
+	}
+	if (!head) fileCacheBytesServed += entry->size;
+	
+	args.GetReturnValue().Set(true);
+}
+
+static void HttpSetFileCache(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+	Local<Context> context = isolate->GetCurrentContext();
+	
+	if (args.Length() < 1 || !args[0]->IsObject())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+	Local<Object> opts = Local<Object>::Cast(args[0]);
+	Local<Value> maxBytes = opts->Get(context, v8::String::NewFromUtf8(isolate, "maxBytes")TO_LOCAL_CHECKED)TO_LOCAL_CHECKED;
+	Local<Value> maxFileSize = opts->Get(context, v8::String::NewFromUtf8(isolate, "maxFileSize")TO_LOCAL_CHECKED)TO_LOCAL_CHECKED;
+	Local<Value> maxEntries = opts->Get(context, v8::String::NewFromUtf8(isolate, "maxEntries")TO_LOCAL_CHECKED)TO_LOCAL_CHECKED;
+	
+	std::lock_guard<std::mutex> lock(fileCacheMutex);
+	if (maxBytes->IsNumber()) fileCacheMaxBytes = (size_t)maxBytes->NumberValue(context).FromMaybe(0);
+	if (maxFileSize->IsNumber()) fileCacheMaxFileSize = (size_t)maxFileSize->NumberValue(context).FromMaybe(0);
+	if (maxEntries->IsNumber()) fileCacheMaxEntries = (size_t)maxEntries->NumberValue(context).FromMaybe(0);
+	FileCacheEvictLocked();
+}
+
+static void HttpClearFileCache(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+	
+	std::lock_guard<std::mutex> lock(fileCacheMutex);
+	fileCacheLru.clear();
+	fileCacheMap.clear();
+	fileCacheMemBytes = 0;
+}
+
+static void HttpGetFileCacheStats(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+	Local<Context> context = isolate->GetCurrentContext();
+	
+	size_t entries, memBytes, maxBytes, maxFileSize, maxEntries;
+	{
+		std::lock_guard<std::mutex> lock(fileCacheMutex);
+		entries = fileCacheMap.size();
+		memBytes = fileCacheMemBytes;
+		maxBytes = fileCacheMaxBytes;
+		maxFileSize = fileCacheMaxFileSize.load();
+		maxEntries = fileCacheMaxEntries;
+	}
+	
+	Local<Object> res = Object::New(isolate);	
+	res->Set(context, v8::String::NewFromUtf8(isolate,"hits")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheHits.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"misses")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheMisses.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"notModified")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheNotModified.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"bytesServed")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheBytesServed.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"streamed")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheStreamed.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"streamErrors")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)fileCacheStreamErrors.load())).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"entries")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)entries)).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"cachedBytes")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)memBytes)).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"maxBytes")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)maxBytes)).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"maxFileSize")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)maxFileSize)).FromJust();
+	res->Set(context, v8::String::NewFromUtf8(isolate,"maxEntries")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)maxEntries)).FromJust();
+	args.GetReturnValue().Set(res);
 }
 
 char* strtolower(char* s) {
@@ -496,7 +799,10 @@ static void HttpRequest(const v8::FunctionCallbackInfo<v8::Value>& args)
 	curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
 	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, timeout);
 
+    int64_t start = TinnMetricsNow();
     CURLcode result = curl_easy_perform(curl);
+	TinnMetricRecord(metricClientRequest, TinnMetricsNow() - start);
+	if (result != CURLE_OK) TinnMetricAdd(metricClientErrors, 1);
 	Local<Object> res = Object::New(isolate);	
 	res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"result")TO_LOCAL_CHECKED, v8::Integer::New(isolate,(int)result));
 	res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"response")TO_LOCAL_CHECKED, v8::String::NewFromUtf8(isolate, buf)TO_LOCAL_CHECKED);
@@ -524,11 +830,15 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	http->Set(v8::String::NewFromUtf8(isolate, "closeSocket")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpCloseSocket));
 	http->Set(v8::String::NewFromUtf8(isolate, "request")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpRequest));
 	http->Set(v8::String::NewFromUtf8(isolate, "serveFile")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpServeFile));
+	http->Set(v8::String::NewFromUtf8(isolate, "setFileCache")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpSetFileCache));
+	http->Set(v8::String::NewFromUtf8(isolate, "clearFileCache")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpClearFileCache));
+	http->Set(v8::String::NewFromUtf8(isolate, "getFileCacheStats")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HttpGetFileCacheStats));
 	
 	http->SetInternalFieldCount(1);  
 		
 	HttpContext * ctx = new HttpContext();
 	ctx->request = NULL;
+	ctx->acceptedAt = 0;
 	
 	CURL *curl = curl_easy_init();
 	if (!curl)
@@ -557,6 +867,18 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 
 extern "C" bool LIBRARY_API init() 
 {
+	// times are in microseconds
+	TinnMetricsInit();
+	metricAcceptWait = TinnMetric("http.accept_wait_us", TINN_METRIC_HISTOGRAM);
+	metricRequests = TinnMetric("http.requests", TINN_METRIC_COUNTER);
+	metricInFlight = TinnMetric("http.in_flight", TINN_METRIC_GAUGE);
+	metricHandler = TinnMetric("http.handler_us", TINN_METRIC_HISTOGRAM);
+	metricRequestBody = TinnMetric("http.request_body_us", TINN_METRIC_HISTOGRAM);
+	metricRequestBodyBytes = TinnMetric("http.request_body_bytes", TINN_METRIC_COUNTER);
+	metricServeFile = TinnMetric("http.serve_file_us", TINN_METRIC_HISTOGRAM);
+	metricFinish = TinnMetric("http.finish_us", TINN_METRIC_HISTOGRAM);
+	metricClientRequest = TinnMetric("http.client_request_us", TINN_METRIC_HISTOGRAM);
+	metricClientErrors = TinnMetric("http.client_errors", TINN_METRIC_COUNTER);
  	return true;
 }
 
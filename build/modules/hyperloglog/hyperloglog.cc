@@ -12,6 +12,8 @@ found in the LICENSE file.
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <string>
 #include "hyperloglog.hpp"
 
 #include "v8adapt.h"
@@ -27,50 +29,469 @@ using namespace std;
 using namespace v8;
 using namespace hll;
 
+// serialized sketch layouts; the first byte of the legacy dump() layout is
+// the bit width (4..30) so these never collide with it
+#define HLL_FORMAT_DENSE 0x81	// [format][b][2^b registers]
+#define HLL_FORMAT_SPARSE 0x82	// [format][b][uint32 n][n x uint32 (index << 5 | rank)]
+
+#define HLL_MIN_BITS 4
+#define HLL_MAX_BITS 30
+#define HLL_MAX_SPARSE_BITS 27
+
+// gives access to the registers of the library's HyperLogLog
+class NativeHll : public HyperLogLog {
+public:
+	NativeHll(uint8_t b) : HyperLogLog(b) {}
+
+	uint8_t bits() const { return b_; }
+	uint8_t* registers() { return &M_[0]; }
+	uint8_t maxRank() const { return 33 - b_; }
+
+	// same as HyperLogLog::add(), returns true if a register changed
+	bool addBytes(const char* str, uint32_t len) {
+		uint32_t hash;
+		MurmurHash3_x86_32(str, len, HLL_HASH_SEED, (void*) &hash);
+		uint32_t index = hash >> (32 - b_);
+		uint8_t rank = _GET_CLZ((hash << b_), 32 - b_);
+		if (rank > M_[index]) {
+			M_[index] = rank;
+			return true;
+		}
+		return false;
+	}
+
+	// register-wise max, written so that the compiler vectorizes it
+	void mergeRegisters(const uint8_t* __restrict src) {
+		uint8_t* __restrict dst = &M_[0];
+		for (uint32_t i = 0; i < m_; i++) {
+			dst[i] = dst[i] < src[i] ? src[i] : dst[i];
+		}
+	}
+};
+
+typedef struct {
+	NativeHll* hll;
+	Global<Object> handle;
+} HllSketch;
+
+// stored in internal field 0 of Sketch objects to recognize them
+static int hllSketchTag;
+
 static Local<Value> Throw(Isolate* isolate, const char* message) {
 	return isolate->ThrowException(v8::Exception::Error(String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
 }
 
-Handle<Array> dumpHll(Isolate* isolate, HyperLogLog &hll) {
+static inline uint32_t ReadUint32(const uint8_t* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
     
-    Local<Context> context = isolate->GetCurrentContext();
-    Context::Scope context_scope(context);	
+static inline void WriteUint32(uint8_t* p, uint32_t v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
 	
-	stringstream ss(stringstream::in | stringstream::out |stringstream::binary);
-	hll.dump(ss);
-
-    std::streambuf * pbuf = ss.rdbuf();
-    std::streamsize size = pbuf->pubseekoff(0,ss.end);
-    pbuf->pubseekoff(0,ss.beg);       // rewind
-    char* contents = new char [size];
-	pbuf->sgetn (contents,size);
+static HllSketch* GetSketch(Local<Value> value) {
+	if (!value->IsObject()) return NULL;
+	Local<Object> obj = Local<Object>::Cast(value);
+	if (obj->InternalFieldCount() != 2 || obj->GetAlignedPointerFromInternalField(0) != &hllSketchTag) return NULL;
+	return static_cast<HllSketch*>(obj->GetAlignedPointerFromInternalField(1));
+}
+
+// points data/len at the contents of an ArrayBuffer or view
+static bool GetBytes(Local<Value> value, const uint8_t** data, size_t* len) {
+	if (value->IsArrayBufferView()) {
+		Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(value);
+		*data = (const uint8_t*)view->Buffer()->GetContents().Data() + view->ByteOffset();
+		*len = view->ByteLength();
+		return true;
+	} else if (value->IsArrayBuffer()) {
+		ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(value)->GetContents();
+		*data = (const uint8_t*)contents.Data();
+		*len = contents.ByteLength();
+		return true;
+	}
+	return false;
+}
 	
-	Handle<Array> jsBytes = v8::Array::New(isolate, size);
-	for (unsigned int i=0; i<size; i++)
+// the bytes add() hashes: the raw bytes of ArrayBuffers or the utf-8 form of anything else
+static bool GetElement(Isolate* isolate, Local<Value> value, std::string &storage, const char** data, uint32_t* len) {
+	const uint8_t* bytes;
+	size_t size;
+	if (GetBytes(value, &bytes, &size)) {
+		*data = (const char*)bytes;
+		*len = (uint32_t)size;
+		return true;
+	}
+	Local<String> str;
+	if (!value->ToString(isolate->GetCurrentContext()).ToLocal(&str)) return false;
+	int length = str->Utf8Length(isolate);
+	storage.resize(length + 1);
+	str->WriteUtf8(isolate, &storage[0], length, NULL, String::NO_NULL_TERMINATION);
+	*data = storage.data();
+	*len = length;
+	return true;
+}
+
+static bool CheckRegisters(NativeHll* hll) {
+	const uint8_t* regs = hll->registers();
+	uint8_t maxRank = hll->maxRank();
+	uint8_t max = 0;
+	for (uint32_t i = 0; i < hll->registerSize(); i++) {
+		max = regs[i] > max ? regs[i] : max;
+	}
+	return max <= maxRank;
+}
+
+// applies a serialized sketch to hll (which must have the same bit width) taking the max of each register
+static bool MergeBytes(NativeHll* hll, const uint8_t* data, size_t len) {
+	uint32_t m = hll->registerSize();
+	if (len >= 2 && data[0] == HLL_FORMAT_DENSE && data[1] == hll->bits() && len == 2 + (size_t)m) {
+		hll->mergeRegisters(data + 2);
+	} else if (len >= 1 && data[0] == hll->bits() && len == 1 + (size_t)m) {
+		hll->mergeRegisters(data + 1);
+	} else if (len >= 6 && data[0] == HLL_FORMAT_SPARSE && data[1] == hll->bits() && len == 6 + (size_t)ReadUint32(data + 2) * 4) {
+		uint8_t* regs = hll->registers();
+		uint8_t maxRank = hll->maxRank();
+		uint32_t n = ReadUint32(data + 2);
+		for (uint32_t i = 0; i < n; i++) {
+			uint32_t entry = ReadUint32(data + 6 + i * 4);
+			uint32_t index = entry >> 5;
+			uint8_t rank = entry & 0x1f;
+			if (index >= m || rank > maxRank) return false;
+			if (rank > regs[index]) regs[index] = rank;
+		}
+		return true;
+	} else {
+		return false;
+	}
+	return CheckRegisters(hll);
+}
+
+// bit width of a serialized sketch (current or legacy layout), 0 if invalid
+static uint8_t GetBytesBits(const uint8_t* data, size_t len) {
+	if (len < 2) return 0;
+	uint8_t b = (data[0] == HLL_FORMAT_DENSE || data[0] == HLL_FORMAT_SPARSE) ? data[1] : data[0];
+	return b >= HLL_MIN_BITS && b <= HLL_MAX_BITS ? b : 0;
+}
+
+// reads the legacy array format: one element per byte of HyperLogLog::dump()
+static NativeHll* restoreHll(Isolate * isolate, Handle<Array> aBytes) {
+	Local<Context> context = isolate->GetCurrentContext();
+	uint32_t size = aBytes->Length();
+	if (size < 2) return NULL;
+	uint32_t b = aBytes->Get(CONTEXT_ARG 0)TO_LOCAL_CHECKED ->Uint32Value(context).FromMaybe(0L);
+	if (b < HLL_MIN_BITS || b > HLL_MAX_BITS || size != 1 + (1u << b)) return NULL;
+
+	NativeHll* hll = new NativeHll(b);
+	uint8_t* regs = hll->registers();
+	for (uint32_t i = 1; i < size; i++) {
+		regs[i - 1] = aBytes->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED ->Uint32Value(context).FromMaybe(0L);
+	}
+	if (!CheckRegisters(hll)) {
+		delete hll;
+		return NULL;
+	}
+	return hll;
+}
+
+// writes the legacy array format
+Handle<Array> dumpHll(Isolate* isolate, NativeHll &hll) {
+	Local<Context> context = isolate->GetCurrentContext();
+	uint32_t m = hll.registerSize();
+	const uint8_t* regs = hll.registers();
+
+	Handle<Array> jsBytes = v8::Array::New(isolate, m + 1);
+	jsBytes->Set(context, 0, v8::Integer::New(isolate, hll.bits())).FromJust();
+	for (uint32_t i = 0; i < m; i++)
 	{
-		jsBytes->Set(CONTEXT_ARG i, v8::Integer::New(isolate, contents[i]));
+		jsBytes->Set(context, i + 1, v8::Integer::New(isolate, regs[i])).FromJust();
 	}
-	delete[] contents;
 	return jsBytes;
 }
 
-void restoreHll(Isolate * isolate, Handle<Array> aBytes, HyperLogLog &hll) {
+// a new sketch copied from a Sketch, serialized sketch or legacy array; throws and returns NULL if invalid
+static NativeHll* NewHllFromValue(Isolate* isolate, Local<Value> value) {
+	HllSketch* sketch = GetSketch(value);
+	if (sketch != NULL) {
+		NativeHll* hll = new NativeHll(sketch->hll->bits());
+		hll->mergeRegisters(sketch->hll->registers());
+		return hll;
+	}
     
-    Local<Context> context = isolate->GetCurrentContext();
-    Context::Scope context_scope(context);	
-	
-	std::streamsize size = aBytes->Length();    
-	char* contents = new char [size];
-	stringstream ss2(stringstream::in | stringstream::out |stringstream::binary);
-	for (unsigned int i=0; i<size;i++)
-	{
-		contents[i]= aBytes->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED ->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	NativeHll* hll = NULL;
+	const uint8_t* data;
+	size_t len;
+	if (GetBytes(value, &data, &len)) {
+		uint8_t b = GetBytesBits(data, len);
+		if (b != 0) {
+			hll = new NativeHll(b);
+			if (!MergeBytes(hll, data, len)) {
+				delete hll;
+				hll = NULL;
+			}
+		}
+	} else if (value->IsArray()) {
+		hll = restoreHll(isolate, Handle<Array>::Cast(value));
+	}
+	if (hll == NULL) {
+		Throw(isolate, "invalid HyperLogLog data");
+	}
+	return hll;
+}
+
+// merges a Sketch, serialized sketch or legacy array into hll; throws and returns false if invalid
+static bool MergeValue(Isolate* isolate, NativeHll* hll, Local<Value> value) {
+	HllSketch* sketch = GetSketch(value);
+	const uint8_t* data;
+	size_t len;
+	if (sketch != NULL) {
+		if (sketch->hll->bits() != hll->bits()) {
+			Throw(isolate, "number of registers doesn't match");
+			return false;
+		}
+		hll->mergeRegisters(sketch->hll->registers());
+		return true;
+	} else if (GetBytes(value, &data, &len)) {
+		if (GetBytesBits(data, len) != hll->bits()) {
+			Throw(isolate, GetBytesBits(data, len) == 0 ? "invalid HyperLogLog data" : "number of registers doesn't match");
+			return false;
+		}
+		NativeHll tmp(hll->bits());
+		if (!MergeBytes(&tmp, data, len)) {
+			Throw(isolate, "invalid HyperLogLog data");
+			return false;
+		}
+		hll->mergeRegisters(tmp.registers());
+		return true;
+	}
+
+	std::unique_ptr<NativeHll> other(NewHllFromValue(isolate, value));
+	if (!other) return false;
+	if (other->bits() != hll->bits()) {
+		Throw(isolate, "number of registers doesn't match");
+		return false;
 	}
-	ss2.write(contents,size);
-	hll.restore(ss2);
-	delete[] contents;	
+	hll->mergeRegisters(other->registers());
+	return true;
+}
+
+static void HllSketchWeakCallback(const WeakCallbackInfo<HllSketch>& data) {
+	HllSketch* sketch = data.GetParameter();
+	data.GetIsolate()->AdjustAmountOfExternalAllocatedMemory(-(int64_t)sketch->hll->registerSize());
+	sketch->handle.Reset();
+	delete sketch->hll;
+	delete sketch;
 }
 
+// new HyperLogLog.Sketch(bits | sketch | ArrayBuffer | legacy array)
+static void HllSketchNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	if (!args.IsConstructCall()) {
+		Throw(isolate, "HyperLogLog.Sketch must be constructed with new");
+		return;
+	}
+
+	NativeHll* hll = NULL;
+	if (args.Length() == 0 || args[0]->IsUint32()) {
+		unsigned int b = args.Length() == 0 ? 14 : args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+		if (b < HLL_MIN_BITS || b > HLL_MAX_BITS) {
+			Throw(isolate, "bit width must be in the range [4,30]");
+			return;
+		}
+		hll = new NativeHll(b);
+	} else {
+		hll = NewHllFromValue(isolate, args[0]);
+		if (hll == NULL) return;
+	}
+
+	HllSketch* sketch = new HllSketch();
+	sketch->hll = hll;
+	args.Holder()->SetAlignedPointerInInternalField(0, &hllSketchTag);
+	args.Holder()->SetAlignedPointerInInternalField(1, sketch);
+	sketch->handle.Reset(isolate, args.Holder());
+	sketch->handle.SetWeak(sketch, HllSketchWeakCallback, WeakCallbackType::kParameter);
+	isolate->AdjustAmountOfExternalAllocatedMemory(hll->registerSize());
+}
+
+static NativeHll* GetHolderHll(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	HllSketch* sketch = GetSketch(args.Holder());
+	if (sketch == NULL) {
+		Throw(args.GetIsolate(), "invalid HyperLogLog.Sketch");
+		return NULL;
+	}
+	return sketch->hll;
+}
+
+// sketch.add(value): returns true if the sketch changed
+static void HllSketchAdd(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	if (args.Length() != 1) {
+		Throw(isolate, "invalid arguments");
+		return;
+	}
+
+	std::string storage;
+	const char* data;
+	uint32_t len;
+	if (!GetElement(isolate, args[0], storage, &data, &len)) return;
+	args.GetReturnValue().Set(hll->addBytes(data, len));
+}
+
+// sketch.addMany(array): returns the number of elements that changed the sketch
+static void HllSketchAddMany(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+	Local<Context> context = isolate->GetCurrentContext();
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	if (args.Length() != 1 || !args[0]->IsArray()) {
+		Throw(isolate, "invalid arguments");
+		return;
+	}
+
+	Local<Array> values = Local<Array>::Cast(args[0]);
+	uint32_t n = values->Length();
+	uint32_t changed = 0;
+	std::string storage;
+	for (uint32_t i = 0; i < n; i++) {
+		HandleScope scope(isolate);
+		Local<Value> value;
+		const char* data;
+		uint32_t len;
+		if (!values->Get(context, i).ToLocal(&value) || !GetElement(isolate, value, storage, &data, &len)) return;
+		if (hll->addBytes(data, len)) changed++;
+	}
+	args.GetReturnValue().Set(changed);
+}
+
+// sketch.merge(other, ...): others can be sketches, serialized sketches or legacy arrays
+static void HllSketchMerge(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	for (int i = 0; i < args.Length(); i++) {
+		if (!MergeValue(isolate, hll, args[i])) return;
+	}
+	args.GetReturnValue().Set(args.Holder());
+}
+
+static void HllSketchCardinality(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	args.GetReturnValue().Set(v8::Number::New(isolate, floor(hll->estimate() + 0.5)));
+}
+
+static void HllSketchClear(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	hll->clear();
+}
+
+// sketch.serialize(): an ArrayBuffer holding either all registers or, when
+// smaller, only the non-zero ones
+static void HllSketchSerialize(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+
+	uint32_t m = hll->registerSize();
+	const uint8_t* regs = hll->registers();
+	uint32_t used = 0;
+	for (uint32_t i = 0; i < m; i++) {
+		used += regs[i] != 0;
+	}
+
+	bool sparse = hll->bits() <= HLL_MAX_SPARSE_BITS && 6 + (size_t)used * 4 < 2 + (size_t)m;
+	size_t len = sparse ? 6 + (size_t)used * 4 : 2 + (size_t)m;
+	Local<ArrayBuffer> buf = ArrayBuffer::New(isolate, len);
+	uint8_t* out = (uint8_t*)buf->GetContents().Data();
+	out[0] = sparse ? HLL_FORMAT_SPARSE : HLL_FORMAT_DENSE;
+	out[1] = hll->bits();
+	if (sparse) {
+		WriteUint32(out + 2, used);
+		uint8_t* p = out + 6;
+		for (uint32_t i = 0; i < m; i++) {
+			if (regs[i] != 0) {
+				WriteUint32(p, (i << 5) | regs[i]);
+				p += 4;
+			}
+		}
+	} else {
+		memcpy(out + 2, regs, m);
+	}
+	args.GetReturnValue().Set(buf);
+}
+
+// sketch.toArray(): the legacy array format, for code still using HyperLogLog.add() & co.
+static void HllSketchToArray(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	NativeHll* hll = GetHolderHll(args);
+	if (hll == NULL) return;
+	args.GetReturnValue().Set(dumpHll(isolate, *hll));
+}
+
+// HyperLogLog.create(bits) and HyperLogLog.restore(data), data.Data() is the Sketch constructor
+static void HyperLogLogNewSketch(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+
+	if (args.Length() != 1) {
+		Throw(isolate, "invalid arguments");
+		return;
+	}
+	Local<Function> ctor = Local<Function>::Cast(args.Data());
+	Local<Value> argv[] = {args[0]};
+	Local<Object> sketch;
+	if (ctor->NewInstance(isolate->GetCurrentContext(), 1, argv).ToLocal(&sketch)) {
+		args.GetReturnValue().Set(sketch);
+	}
+}
+
+// HyperLogLog.mergeMany([a, b, ...]): a new sketch with the union of all the given ones
+static void HyperLogLogMergeMany(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);
+	Local<Context> context = isolate->GetCurrentContext();
+
+	if (args.Length() != 1 || !args[0]->IsArray() || Local<Array>::Cast(args[0])->Length() == 0) {
+		Throw(isolate, "invalid arguments");
+		return;
+	}
+	Local<Array> list = Local<Array>::Cast(args[0]);
+	Local<Function> ctor = Local<Function>::Cast(args.Data());
+	Local<Value> argv[1];
+	Local<Object> result;
+	if (!list->Get(context, 0).ToLocal(&argv[0]) || !ctor->NewInstance(context, 1, argv).ToLocal(&result)) return;
+
+	NativeHll* hll = GetSketch(result)->hll;
+	for (uint32_t i = 1; i < list->Length(); i++) {
+		HandleScope scope(isolate);
+		Local<Value> value;
+		if (!list->Get(context, i).ToLocal(&value) || !MergeValue(isolate, hll, value)) return;
+	}
+	args.GetReturnValue().Set(result);
+}
 
 static void HyperLogLogAddToNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	Isolate* isolate = args.GetIsolate();
@@ -87,10 +508,14 @@ static void HyperLogLogAddToNew(const v8::FunctionCallbackInfo<v8::Value>& args)
 	}
 
 	unsigned int b = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	if (b < HLL_MIN_BITS || b > HLL_MAX_BITS) {
+		Throw(isolate, "bit width must be in the range [4,30]");
+		return;
+	}
 	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[1]));
 	char * str = *jsStr;
 	
-	HyperLogLog hll(b);
+	NativeHll hll(b);
 	hll.add(str, strlen(str));
 	
 	args.GetReturnValue().Set( dumpHll(isolate, hll));	
@@ -115,13 +540,11 @@ static void HyperLogLogAdd(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	v8::String::Utf8Value jsAdd(isolate,Handle<v8::String>::Cast(args[1]));
 	char * add = *jsAdd;
 
-	Handle<Array> aBytes = Handle<Array>::Cast(args[0]);
+	std::unique_ptr<NativeHll> hll2(NewHllFromValue(isolate, args[0]));
+	if (!hll2) return;
+	hll2->add(add, strlen(add));
 	
-	HyperLogLog hll2;
-	restoreHll(isolate,aBytes, hll2);	
-	hll2.add(add, strlen(add));
-	
-	args.GetReturnValue().Set( dumpHll(isolate, hll2));	
+	args.GetReturnValue().Set( dumpHll(isolate, *hll2));
 }
 
 
@@ -138,19 +561,11 @@ static void HyperLogLogMerge(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		Throw(isolate,"invalid arguments");
 		return;
 	}
-	Handle<Array> aBytes1 = Handle<Array>::Cast(args[0]);
-	Handle<Array> aBytes2 = Handle<Array>::Cast(args[1]);
 	
+	std::unique_ptr<NativeHll> hll1(NewHllFromValue(isolate, args[0]));
+	if (!hll1 || !MergeValue(isolate, hll1.get(), args[1])) return;
 
-	HyperLogLog hll1;
-	restoreHll(isolate,aBytes1, hll1);	
-
-	HyperLogLog hll2;
-	restoreHll(isolate,aBytes2, hll2);	
-	
-	hll1.merge(hll2);
-	
-	args.GetReturnValue().Set(dumpHll(isolate, hll1));	 
+	args.GetReturnValue().Set(dumpHll(isolate, *hll1));
 	
 }
 
@@ -164,19 +579,19 @@ static void HyperLogLogGetCardinality(const v8::FunctionCallbackInfo<v8::Value>&
 	{		
 		Throw(isolate,"invalid arguments");
 		return;
-	} else if (!args[0]->IsArray())
-	{
-		Throw(isolate,"invalid argument");
-		return;
 	}
 
-	Handle<Array> aBytes = Handle<Array>::Cast(args[0]);
-	
-	HyperLogLog hll2;
-	restoreHll(isolate,aBytes, hll2);	
+	// accepts the legacy array as well as sketches and serialized sketches
+	HllSketch* sketch = GetSketch(args[0]);
+	std::unique_ptr<NativeHll> hll2;
+	if (sketch == NULL) {
+		hll2.reset(NewHllFromValue(isolate, args[0]));
+		if (!hll2) return;
+	}
 	
-	double cardinality = hll2.estimate();
-	args.GetReturnValue().Set( v8::Integer::New(isolate, (int)cardinality));	
+	double cardinality = (sketch != NULL ? sketch->hll : hll2.get())->estimate();
+	// rounded like sketch.cardinality()
+	args.GetReturnValue().Set( v8::Number::New(isolate, floor(cardinality + 0.5)));	
 }
 
 extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &context) 
@@ -188,7 +603,25 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	hll->Set(v8::String::NewFromUtf8(isolate, "getCardinality")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HyperLogLogGetCardinality));
 	hll->Set(v8::String::NewFromUtf8(isolate, "merge")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HyperLogLogMerge));
 	
+	Local<FunctionTemplate> sketch = FunctionTemplate::New(isolate, HllSketchNew);
+	Local<Signature> signature = Signature::New(isolate, sketch);
+	sketch->SetClassName(v8::String::NewFromUtf8(isolate, "Sketch")TO_LOCAL_CHECKED);
+	sketch->InstanceTemplate()->SetInternalFieldCount(2);
+	Local<ObjectTemplate> proto = sketch->PrototypeTemplate();
+	proto->Set(v8::String::NewFromUtf8(isolate, "add")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchAdd, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "addMany")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchAddMany, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "merge")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchMerge, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "cardinality")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchCardinality, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "clear")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchClear, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "serialize")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchSerialize, Local<Value>(), signature));
+	proto->Set(v8::String::NewFromUtf8(isolate, "toArray")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HllSketchToArray, Local<Value>(), signature));
+
+	v8::Local<v8::Function> ctor = sketch->GetFunction(context).ToLocalChecked();
 	v8::Local<v8::Object> instance = hll->NewInstance(context).ToLocalChecked();	
+	instance->Set(context, v8::String::NewFromUtf8(isolate, "Sketch")TO_LOCAL_CHECKED, ctor).FromJust();
+	instance->Set(context, v8::String::NewFromUtf8(isolate, "create")TO_LOCAL_CHECKED, Function::New(context, HyperLogLogNewSketch, ctor).ToLocalChecked()).FromJust();
+	instance->Set(context, v8::String::NewFromUtf8(isolate, "restore")TO_LOCAL_CHECKED, Function::New(context, HyperLogLogNewSketch, ctor).ToLocalChecked()).FromJust();
+	instance->Set(context, v8::String::NewFromUtf8(isolate, "mergeMany")TO_LOCAL_CHECKED, Function::New(context, HyperLogLogMergeMany, ctor).ToLocalChecked()).FromJust();
 	context->Global()->Set(context,v8::String::NewFromUtf8(isolate,"HyperLogLog")TO_LOCAL_CHECKED, instance).FromJust();	
 	
 	return true;
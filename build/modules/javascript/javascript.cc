@@ -16,8 +16,10 @@ found in the LICENSE file.
 #include "v8adapt.h"
 
 #if defined(_WIN32)
+  #include <windows.h>
   #define LIBRARY_API __declspec(dllexport)
 #else
+  #include <dlfcn.h>
   #define LIBRARY_API
 #endif
 
@@ -52,6 +54,20 @@ static Local<Value> Throw(Isolate* isolate, const char* message) {
 	return isolate->ThrowException(v8::Exception::Error(String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
 }
 
+// Exported by the tinn executable: compiles through its shared (and
+// optionally persistent) code cache so that every isolate loading the same
+// file skips parsing it again.
+typedef bool (*CompileScriptFunc)(Isolate*, Local<String>*, Local<Value>*, const char*, Local<Script>*);
+static CompileScriptFunc tinnCompileScript = NULL;
+
+static bool CompileScript(Isolate* isolate, Local<String> source, Local<Value> name, const char* path, Local<Script>* script) {
+	if (tinnCompileScript != NULL) {
+		return tinnCompileScript(isolate, &source, &name, path, script);
+	}
+	v8::ScriptOrigin origin(name);
+	return Script::Compile(isolate->GetCurrentContext(), source, &origin).ToLocal(script);
+}
+
 JsContext* GetJsContextFromInternalField(Isolate* isolate, Local<Object> object, bool inited = true) {
   JsContext* ctx =
   static_cast<JsContext*>(object->GetAlignedPointerFromInternalField(0));
@@ -153,27 +169,14 @@ static void Run(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		  Throw(args.GetIsolate(), "Error loading file");
 		  return;
 	  }
-	  MaybeLocal<Script> maybe_script;
-	  
 	  if (args.Length() > 1 && !args[1]->IsString()) {
 		  Throw(args.GetIsolate(), "invalid name argument");  
 		  return;
 	  }
 	  
-	  if (args.Length() > 1) {
-		  v8::ScriptOrigin origin(Handle<v8::String>::Cast(args[1]));
-		  maybe_script = Script::Compile(isolate->GetCurrentContext(), source, &origin);
-		  if (!maybe_script.ToLocal(&compiled_script)) {
-			  return;
-		  }	  
-
-	  } else{
-		  v8::Handle<v8::Value> name = v8::String::NewFromUtf8(isolate, *file)TO_LOCAL_CHECKED;
-		  v8::ScriptOrigin origin(name);
-		  maybe_script = Script::Compile(isolate->GetCurrentContext(), source, &origin);
-		  if (!maybe_script.ToLocal(&compiled_script)) {
-			  return;
-		  }	  
+	  v8::Local<v8::Value> name = args.Length() > 1 ? args[1] : Local<Value>::Cast(v8::String::NewFromUtf8(isolate, *file)TO_LOCAL_CHECKED);
+	  if (!CompileScript(isolate, source, name, *file, &compiled_script)) {
+		  return;
 	  }	  
 	  
 	  
@@ -210,5 +213,10 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 
 extern "C" bool LIBRARY_API init() 
 {
+#if defined(_WIN32)
+	tinnCompileScript = (CompileScriptFunc)GetProcAddress(GetModuleHandle(NULL), "tinn_CompileScript");
+#else
+	tinnCompileScript = (CompileScriptFunc)dlsym(RTLD_DEFAULT, "tinn_CompileScript");
+#endif
 	return true;
 }
\ No newline at end of file
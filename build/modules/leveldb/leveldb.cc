@@ -13,10 +13,13 @@ found in the LICENSE file.
 #include <iostream>
 #include <fstream>
 #include <map>
+#include <string>
+#include <vector>
 
 #include "leveldb/db.h"
 #include "leveldb/cache.h"
 #include "leveldb/filter_policy.h"
+#include "leveldb/write_batch.h"
 
 #include "v8adapt.h"
 
@@ -33,10 +36,32 @@ using namespace v8;
 
 
 
+typedef struct {
+	unsigned int dbId;
+	const leveldb::Snapshot * snapshot;
+} LevelDBSnapshot;
+
+typedef struct {
+	unsigned int dbId;
+	leveldb::Iterator * it;
+	std::string start;		// inclusive lower bound, empty for none
+	std::string end;		// exclusive upper bound
+	bool hasEnd;
+	bool reverse;
+	bool keys;
+	bool values;
+	bool binary;
+} LevelDBIterator;
+
 typedef struct {
 	int dbId;
 	map<int,leveldb::DB*> dbs;
 	leveldb::WriteOptions writeOptions;
+	
+	int snapshotId;
+	map<int,LevelDBSnapshot> snapshots;
+	int iteratorId;
+	map<int,LevelDBIterator> iterators;
 } LevelDBContext;
 
 
@@ -51,6 +76,61 @@ LevelDBContext* GetContext(Isolate* isolate, Local<v8::Object> object) {
   return ctx;
 }
 
+// keys and values can be strings or ArrayBuffers/views
+static bool IsSliceValue(Local<Value> value) {
+	return value->IsString() || value->IsArrayBuffer() || value->IsArrayBufferView();
+}
+
+// returns a slice pointing to the contents of value, strings are converted to utf-8 in storage 
+static leveldb::Slice GetSlice(Isolate* isolate, Local<Value> value, std::string &storage) {
+	if (value->IsArrayBufferView()) {
+		Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(value);
+		return leveldb::Slice((const char*)view->Buffer()->GetContents().Data() + view->ByteOffset(), view->ByteLength());
+	} else if (value->IsArrayBuffer()) {
+		ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(value)->GetContents();
+		return leveldb::Slice((const char*)contents.Data(), contents.ByteLength());
+	}
+	v8::String::Utf8Value str(isolate, value);
+	storage.assign(*str, str.length());
+	return leveldb::Slice(storage);
+}
+
+static Local<Value> GetValue(Isolate* isolate, const leveldb::Slice &slice, bool binary) {
+	if (binary) {
+		Local<ArrayBuffer> buf = ArrayBuffer::New(isolate, slice.size());
+		if (slice.size() > 0) memcpy(buf->GetContents().Data(), slice.data(), slice.size());
+		return buf;
+	}
+	return v8::String::NewFromUtf8(isolate, slice.data(), NewStringType::kNormal, slice.size())TO_LOCAL_CHECKED;
+}
+
+static Local<Value> GetOption(Isolate* isolate, Local<Object> options, const char * name) {
+	return options->Get(isolate->GetCurrentContext(), v8::String::NewFromUtf8(isolate, name)TO_LOCAL_CHECKED)TO_LOCAL_CHECKED;
+}
+
+// reads the 'binary' and 'snapshot' options shared by get, multiGet and iterator
+static bool GetReadOptions(Isolate* isolate, LevelDBContext * ctx, unsigned int dbId, Local<Value> value, leveldb::ReadOptions &readOptions, bool &binary) {
+	binary = false;
+	if (value->IsUndefined()) return true;
+	if (!value->IsObject()) {
+		Throw(isolate, "invalid 'options' value");
+		return false;
+	}
+	Local<Object> options = Local<Object>::Cast(value);
+	Local<Value> jsBinary = GetOption(isolate, options, "binary");
+	binary = jsBinary->BooleanValue(isolate);
+	Local<Value> jsSnapshot = GetOption(isolate, options, "snapshot");
+	if (!jsSnapshot->IsUndefined()) {
+		int snapshotId = jsSnapshot->Int32Value(isolate->GetCurrentContext()).FromMaybe(0);
+		if (ctx->snapshots.find(snapshotId) == ctx->snapshots.end() || ctx->snapshots[snapshotId].dbId != dbId) {
+			Throw(isolate, "invalid snapshot handle");
+			return false;
+		}
+		readOptions.snapshot = ctx->snapshots[snapshotId].snapshot;
+	}
+	return true;
+}
+
 
 static void LevelDBOpen(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	Isolate* isolate = args.GetIsolate();
@@ -141,15 +221,16 @@ static void LevelDBPut(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	Isolate* isolate = args.GetIsolate();
 	HandleScope handle_scope(isolate);  
   
-	if (args.Length() != 3 || !args[0]->IsUint32() || !args[1]->IsString() || !args[2]->IsString())
+	if (args.Length() != 3 || !args[0]->IsUint32() || !IsSliceValue(args[1]) || !IsSliceValue(args[2]))
 	{		
 		Throw(isolate,"invalid arguments");
 		return;
 	}
 
 	unsigned int dbId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
-	v8::String::Utf8Value jsKey(isolate,Handle<v8::String>::Cast(args[1]));
-	v8::String::Utf8Value jsValue(isolate,Handle<v8::String>::Cast(args[2]));
+	std::string key, value;
+	leveldb::Slice keySlice = GetSlice(isolate, args[1], key);
+	leveldb::Slice valueSlice = GetSlice(isolate, args[2], value);
 
 	LevelDBContext * ctx = GetContext(isolate, args.Holder());
 	
@@ -158,7 +239,7 @@ static void LevelDBPut(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		return;
 	}
 	
-	leveldb::Status status = ctx->dbs[dbId]->Put(ctx->writeOptions, *jsKey, *jsValue);
+	leveldb::Status status = ctx->dbs[dbId]->Put(ctx->writeOptions, keySlice, valueSlice);
 	
 }
 
@@ -166,14 +247,15 @@ static void LevelDBGet(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	Isolate* isolate = args.GetIsolate();
 	HandleScope handle_scope(isolate);  
   
-	if (args.Length() != 2 || !args[0]->IsUint32() || !args[1]->IsString())
+	if (args.Length() < 2 || args.Length() > 3 || !args[0]->IsUint32() || !IsSliceValue(args[1]))
 	{		
 		Throw(isolate,"invalid arguments");
 		return;
 	}
 
 	unsigned int dbId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
-	v8::String::Utf8Value jsKey(isolate,Handle<v8::String>::Cast(args[1]));
+	std::string key;
+	leveldb::Slice keySlice = GetSlice(isolate, args[1], key);
 
 	LevelDBContext * ctx = GetContext(isolate, args.Holder());
 	
@@ -182,29 +264,32 @@ static void LevelDBGet(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		return;
 	}
 	
+	leveldb::ReadOptions readOptions;
+	bool binary;
+	if (!GetReadOptions(isolate, ctx, dbId, args[2], readOptions, binary)) return;
 
 	std::string document;
-	leveldb::Status status = ctx->dbs[dbId]->Get(leveldb::ReadOptions(), *jsKey, &document);
+	leveldb::Status status = ctx->dbs[dbId]->Get(readOptions, keySlice, &document);
 	if (false == status.ok()) {
 		return;
 	}
 	
-	Handle<v8::String> jsVal = v8::String::NewFromUtf8(isolate, document.c_str())TO_LOCAL_CHECKED;
-	args.GetReturnValue().Set(jsVal);	  
+	args.GetReturnValue().Set(GetValue(isolate, document, binary));	  
 }
 
 static void LevelDBDelete(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	Isolate* isolate = args.GetIsolate();
 	HandleScope handle_scope(isolate);  
   
-	if (args.Length() != 2 || !args[0]->IsUint32() || !args[1]->IsString())
+	if (args.Length() != 2 || !args[0]->IsUint32() || !IsSliceValue(args[1]))
 	{		
 		Throw(isolate,"invalid arguments");
 		return;
 	}
 
 	unsigned int dbId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
-	v8::String::Utf8Value jsKey(isolate,Handle<v8::String>::Cast(args[1]));
+	std::string key;
+	leveldb::Slice keySlice = GetSlice(isolate, args[1], key);
 
 	LevelDBContext * ctx = GetContext(isolate, args.Holder());
 	
@@ -213,7 +298,7 @@ static void LevelDBDelete(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		return;
 	}
 	
-	ctx->dbs[dbId]->Delete(leveldb::WriteOptions(), *jsKey);
+	ctx->dbs[dbId]->Delete(leveldb::WriteOptions(), keySlice);
 
 }
 
@@ -238,11 +323,366 @@ static void LevelDBClose(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		return;
 	}
 	
+	//iterators and snapshots must be released before the db is deleted
+	for (map<int,LevelDBIterator>::iterator it = ctx->iterators.begin(); it != ctx->iterators.end();) {
+		if (it->second.dbId == dbId) {
+			delete it->second.it;
+			it = ctx->iterators.erase(it);
+		} else {
+			++it;
+		}
+	}
+	for (map<int,LevelDBSnapshot>::iterator it = ctx->snapshots.begin(); it != ctx->snapshots.end();) {
+		if (it->second.dbId == dbId) {
+			ctx->dbs[dbId]->ReleaseSnapshot(it->second.snapshot);
+			it = ctx->snapshots.erase(it);
+		} else {
+			++it;
+		}
+	}
+	
 	delete ctx->dbs[dbId];
 	ctx->dbs.erase(dbId);
 
 }
 
+/*
+ LevelDB.write(db, [['put', key, value], ['del', key], ...], {sync}) applies all the 
+ operations atomically with a single leveldb::WriteBatch
+*/
+static void LevelDBWrite(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+	Local<Context> context = isolate->GetCurrentContext();
+  
+	if (args.Length() < 2 || !args[0]->IsUint32() || !args[1]->IsArray())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int dbId = args[0]->Uint32Value(context).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->dbs.find(dbId)==ctx->dbs.end()){
+		Throw(isolate,"invalid db handle");
+		return;
+	}
+	
+	leveldb::WriteOptions writeOptions = ctx->writeOptions;
+	if (args.Length() > 2) {
+		if (!args[2]->IsObject()) {
+			Throw(isolate, "invalid 'options' value");
+			return;
+		}
+		Local<Value> jsSync = GetOption(isolate, Local<Object>::Cast(args[2]), "sync");
+		if (!jsSync->IsUndefined()) writeOptions.sync = jsSync->BooleanValue(isolate);
+	}
+	
+	Local<Array> ops = Local<Array>::Cast(args[1]);
+	leveldb::WriteBatch batch;
+	std::string key, value;
+	for (unsigned int i=0; i<ops->Length(); i++) {
+		Local<Value> jsOp = ops->Get(context, i)TO_LOCAL_CHECKED;
+		if (!jsOp->IsArray()) {
+			Throw(isolate,"invalid batch operation");
+			return;
+		}
+		Local<Array> op = Local<Array>::Cast(jsOp);
+		v8::String::Utf8Value type(isolate, op->Get(context, 0)TO_LOCAL_CHECKED);
+		Local<Value> jsKey = op->Get(context, 1)TO_LOCAL_CHECKED;
+		if (!IsSliceValue(jsKey)) {
+			Throw(isolate,"invalid batch operation");
+			return;
+		}
+		if (strcmp(*type, "put") == 0 && op->Length() == 3) {
+			Local<Value> jsValue = op->Get(context, 2)TO_LOCAL_CHECKED;
+			if (!IsSliceValue(jsValue)) {
+				Throw(isolate,"invalid batch operation");
+				return;
+			}
+			batch.Put(GetSlice(isolate, jsKey, key), GetSlice(isolate, jsValue, value));
+		} else if (strcmp(*type, "del") == 0 && op->Length() == 2) {
+			batch.Delete(GetSlice(isolate, jsKey, key));
+		} else {
+			Throw(isolate,"invalid batch operation");
+			return;
+		}
+	}
+	
+	leveldb::Status status = ctx->dbs[dbId]->Write(writeOptions, &batch);
+	if (!status.ok()) {
+		Throw(isolate, status.ToString().c_str());
+		return;
+	}
+	args.GetReturnValue().Set(v8::Integer::New(isolate, ops->Length()));
+}
+
+/*
+ LevelDB.multiGet(db, [key1, key2, ...], {binary, snapshot}) returns the values in the order 
+ of the keys, null for the keys that are not found. When no snapshot is given an implicit one 
+ is used so that all the values are read from the same state of the db.
+*/
+static void LevelDBMultiGet(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+	Local<Context> context = isolate->GetCurrentContext();
+  
+	if (args.Length() < 2 || !args[0]->IsUint32() || !args[1]->IsArray())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int dbId = args[0]->Uint32Value(context).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->dbs.find(dbId)==ctx->dbs.end()){
+		Throw(isolate,"invalid db handle");
+		return;
+	}
+	leveldb::DB * db = ctx->dbs[dbId];
+	
+	leveldb::ReadOptions readOptions;
+	bool binary;
+	if (!GetReadOptions(isolate, ctx, dbId, args[2], readOptions, binary)) return;
+	const leveldb::Snapshot * snapshot = NULL;
+	if (readOptions.snapshot == NULL) {
+		snapshot = db->GetSnapshot();
+		readOptions.snapshot = snapshot;
+	}
+	
+	Local<Array> keys = Local<Array>::Cast(args[1]);
+	Local<Array> res = v8::Array::New(isolate, keys->Length());
+	std::string key, document;
+	for (unsigned int i=0; i<keys->Length(); i++) {
+		Local<Value> jsKey = keys->Get(context, i)TO_LOCAL_CHECKED;
+		if (!IsSliceValue(jsKey)) {
+			if (snapshot) db->ReleaseSnapshot(snapshot);
+			Throw(isolate,"invalid key");
+			return;
+		}
+		leveldb::Status status = db->Get(readOptions, GetSlice(isolate, jsKey, key), &document);
+		if (status.ok()) {
+			res->Set(context, i, GetValue(isolate, document, binary)).FromJust();
+		} else {
+			res->Set(context, i, v8::Null(isolate)).FromJust();
+		}
+	}
+	if (snapshot) db->ReleaseSnapshot(snapshot);
+	args.GetReturnValue().Set(res);
+}
+
+static void LevelDBSnapshotNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+  
+	if (args.Length() != 1 || !args[0]->IsUint32())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int dbId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->dbs.find(dbId)==ctx->dbs.end()){
+		Throw(isolate,"invalid db handle");
+		return;
+	}
+	
+	ctx->snapshotId++;
+	LevelDBSnapshot &snapshot = ctx->snapshots[ctx->snapshotId];
+	snapshot.dbId = dbId;
+	snapshot.snapshot = ctx->dbs[dbId]->GetSnapshot();
+	args.GetReturnValue().Set(v8::Integer::New(isolate, ctx->snapshotId));
+}
+
+static void LevelDBReleaseSnapshot(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+  
+	if (args.Length() != 1 || !args[0]->IsUint32())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int snapshotId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->snapshots.find(snapshotId)==ctx->snapshots.end()){
+		Throw(isolate,"invalid snapshot handle");
+		return;
+	}
+	
+	LevelDBSnapshot &snapshot = ctx->snapshots[snapshotId];
+	ctx->dbs[snapshot.dbId]->ReleaseSnapshot(snapshot.snapshot);
+	ctx->snapshots.erase(snapshotId);
+}
+
+// smallest key that is greater than all the keys starting with prefix, empty if there is none 
+static std::string PrefixEnd(const std::string &prefix) {
+	std::string end = prefix;
+	while (!end.empty()) {
+		unsigned char c = (unsigned char)end[end.size()-1];
+		if (c != 0xff) {
+			end[end.size()-1] = (char)(c + 1);
+			return end;
+		}
+		end.resize(end.size()-1);
+	}
+	return end;
+}
+
+/*
+ LevelDB.iterator(db, {start, end, prefix, reverse, keys, values, binary, snapshot}) creates 
+ an iterator over the keys in [start, end) (or starting with prefix), in ascending order or 
+ descending when reverse is true. Entries are then read in chunks with LevelDB.next().
+ keys and values can't both be false.
+*/
+static void LevelDBIteratorNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+  
+	if (args.Length() < 1 || !args[0]->IsUint32())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int dbId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->dbs.find(dbId)==ctx->dbs.end()){
+		Throw(isolate,"invalid db handle");
+		return;
+	}
+	
+	leveldb::ReadOptions readOptions;
+	readOptions.fill_cache = false;
+	LevelDBIterator iter;
+	iter.dbId = dbId;
+	iter.hasEnd = false;
+	iter.reverse = false;
+	iter.keys = true;
+	iter.values = true;
+	Local<Value> jsOptions = args[1];
+	if (!GetReadOptions(isolate, ctx, dbId, jsOptions, readOptions, iter.binary)) return;
+	
+	if (jsOptions->IsObject()) {
+		Local<Object> options = Local<Object>::Cast(jsOptions);
+		Local<Value> jsPrefix = GetOption(isolate, options, "prefix");
+		Local<Value> jsStart = GetOption(isolate, options, "start");
+		Local<Value> jsEnd = GetOption(isolate, options, "end");
+		Local<Value> jsReverse = GetOption(isolate, options, "reverse");
+		Local<Value> jsKeys = GetOption(isolate, options, "keys");
+		Local<Value> jsValues = GetOption(isolate, options, "values");
+		Local<Value> jsFillCache = GetOption(isolate, options, "fill_cache");
+		
+		if (IsSliceValue(jsPrefix)) {
+			GetSlice(isolate, jsPrefix, iter.start);
+			iter.end = PrefixEnd(iter.start);
+			iter.hasEnd = !iter.end.empty();
+		} else {
+			if (IsSliceValue(jsStart)) GetSlice(isolate, jsStart, iter.start);
+			if (IsSliceValue(jsEnd)) {
+				GetSlice(isolate, jsEnd, iter.end);
+				iter.hasEnd = true;
+			}
+		}
+		if (!jsReverse->IsUndefined()) iter.reverse = jsReverse->BooleanValue(isolate);
+		if (!jsKeys->IsUndefined()) iter.keys = jsKeys->BooleanValue(isolate);
+		if (!jsValues->IsUndefined()) iter.values = jsValues->BooleanValue(isolate);
+		if (!iter.keys && !iter.values) {
+			// next() would return [] for existing entries, which means exhausted
+			Throw(isolate, "invalid arguments");
+			return;
+		}
+		if (!jsFillCache->IsUndefined()) readOptions.fill_cache = jsFillCache->BooleanValue(isolate);
+	}
+	
+	iter.it = ctx->dbs[dbId]->NewIterator(readOptions);
+	if (!iter.reverse) {
+		iter.it->Seek(iter.start);
+	} else if (iter.hasEnd) {
+		iter.it->Seek(iter.end);
+		if (iter.it->Valid()) iter.it->Prev();
+		else iter.it->SeekToLast();
+	} else {
+		iter.it->SeekToLast();
+	}
+	
+	ctx->iteratorId++;
+	ctx->iterators[ctx->iteratorId] = iter;
+	args.GetReturnValue().Set(v8::Integer::New(isolate, ctx->iteratorId));
+}
+
+/*
+ LevelDB.next(iterator, count) returns up to count entries as a flat array 
+ [key1, value1, key2, value2, ...] (only keys or only values when the iterator was created 
+ with values:false or keys:false). An empty array means that the iterator is exhausted.
+*/
+static void LevelDBIteratorNext(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+	Local<Context> context = isolate->GetCurrentContext();
+  
+	if (args.Length() < 1 || !args[0]->IsUint32() || (args.Length() > 1 && !args[1]->IsUint32()))
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int iteratorId = args[0]->Uint32Value(context).FromMaybe(0L);
+	unsigned int count = args.Length() > 1 ? args[1]->Uint32Value(context).FromMaybe(1000L) : 1000;
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->iterators.find(iteratorId)==ctx->iterators.end()){
+		Throw(isolate,"invalid iterator handle");
+		return;
+	}
+	LevelDBIterator &iter = ctx->iterators[iteratorId];
+	leveldb::Iterator * it = iter.it;
+	leveldb::Slice start(iter.start), end(iter.end);
+	
+	Local<Array> res = v8::Array::New(isolate);
+	unsigned int n = 0;
+	for (unsigned int i=0; i<count && it->Valid(); i++) {
+		leveldb::Slice key = it->key();
+		if (!iter.reverse && iter.hasEnd && key.compare(end) >= 0) break;
+		if (iter.reverse && key.compare(start) < 0) break;
+		
+		if (iter.keys) res->Set(context, n++, GetValue(isolate, key, iter.binary)).FromJust();
+		if (iter.values) res->Set(context, n++, GetValue(isolate, it->value(), iter.binary)).FromJust();
+		if (iter.reverse) it->Prev();
+		else it->Next();
+	}
+	args.GetReturnValue().Set(res);
+}
+
+static void LevelDBIteratorClose(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+  
+	if (args.Length() != 1 || !args[0]->IsUint32())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	}
+
+	unsigned int iteratorId = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	LevelDBContext * ctx = GetContext(isolate, args.Holder());
+	
+	if (ctx->iterators.find(iteratorId)==ctx->iterators.end()){
+		Throw(isolate,"invalid iterator handle");
+		return;
+	}
+	
+	delete ctx->iterators[iteratorId].it;
+	ctx->iterators.erase(iteratorId);
+}
+
 extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &context) 
 {
 	Handle<ObjectTemplate> leveldb = ObjectTemplate::New(isolate);
@@ -252,12 +692,21 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	leveldb->Set(v8::String::NewFromUtf8(isolate, "get")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBGet));
 	leveldb->Set(v8::String::NewFromUtf8(isolate, "delete")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBDelete));
 	leveldb->Set(v8::String::NewFromUtf8(isolate, "close")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBClose));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "write")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBWrite));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "multiGet")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBMultiGet));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "snapshot")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBSnapshotNew));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "releaseSnapshot")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBReleaseSnapshot));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "iterator")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBIteratorNew));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "next")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBIteratorNext));
+	leveldb->Set(v8::String::NewFromUtf8(isolate, "closeIterator")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LevelDBIteratorClose));
 	
 	leveldb->SetInternalFieldCount(1);  
 	
 	v8::Local<v8::Object> instance = leveldb->NewInstance(context).ToLocalChecked();	
 	LevelDBContext *ctx = new LevelDBContext();	
 	ctx->dbId = 0;
+	ctx->snapshotId = 0;
+	ctx->iteratorId = 0;
 	instance->SetAlignedPointerInInternalField(0, ctx);		
 	
 	context->Global()->Set(context,v8::String::NewFromUtf8(isolate,"LevelDB")TO_LOCAL_CHECKED, instance).FromJust();
@@ -12,13 +12,9 @@ found in the LICENSE file.
 #include <log4cxx/logger.h>
 #include <log4cxx/basicconfigurator.h>
 #include <log4cxx/propertyconfigurator.h>
-
-#define TRACE(X,Y) LOG4CXX_TRACE(X, Y);
-#define DEBUG(X,Y) LOG4CXX_DEBUG(X, Y);
-#define INFO(X,Y) LOG4CXX_INFO(X, Y);
-#define WARN(X,Y) LOG4CXX_WARN(X, Y);
-#define ERROR(X,Y) LOG4CXX_ERROR(X, Y);
-#define FATAL(X,Y) LOG4CXX_FATAL(X, Y);
+#include <log4cxx/spi/loggingevent.h>
+#include <log4cxx/helpers/pool.h>
+#include <log4cxx/helpers/transcoder.h>
 
 
 #include "v8adapt.h"		
@@ -30,6 +26,13 @@ found in the LICENSE file.
 #endif
 
 #include <string>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
 	
 
 using namespace std;
@@ -41,6 +44,12 @@ LoggerPtr mainLogger;
 #else
 log4cxx::LoggerPtr mainLogger;	
 #endif
+
+// Log.init runs under logInitMutex and publishes mainLogger and asyncLog by setting
+// logReady (release); Workers check logReady (acquire) before touching either of them,
+// and neither changes once published
+static std::mutex logInitMutex;
+static std::atomic<bool> logReady(false);
 	
 
 #ifndef _WIN32 
@@ -52,6 +61,230 @@ static Local<Value> Throw(Isolate* isolate, const char* message) {
 }
 
 
+#define LOG_OVERFLOW_BLOCK 0	// wait for room in the queue
+#define LOG_OVERFLOW_DROP 1	// drop the event
+#define LOG_OVERFLOW_COUNT 2	// drop the event, the flush thread later logs how many were dropped
+
+// one queued event, seq implements Vyukov's bounded MPMC queue
+typedef struct {
+	std::atomic<size_t> seq;
+	log4cxx::LoggerPtr logger;
+	log4cxx::spi::LoggingEventPtr event;
+} LogSlot;
+
+// async mode: Log.* calls from every Worker push events to a bounded lock-free
+// queue and a single thread hands them to the log4cxx appenders in batches
+typedef struct {
+	std::unique_ptr<LogSlot[]> slots;
+	size_t mask;
+	std::atomic<size_t> enqueuePos;
+	std::atomic<size_t> dequeuePos;
+
+	int overflow;
+	size_t batchSize;
+	std::thread thread;
+	std::atomic<bool> stopping;
+	std::atomic<bool> exited;	// set by the flush thread when it returns
+	std::atomic<bool> sleeping;
+	std::atomic<int> waiters;	// producers waiting for room or for a flush
+	std::mutex mutex;
+	std::condition_variable wakeup;	// wakes the flush thread
+	std::condition_variable progress;	// signalled by the flush thread after each batch
+
+	std::atomic<uint64_t> enqueued;
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> blocked;
+	uint64_t droppedReported;
+} AsyncLog;
+
+static std::atomic<AsyncLog*> asyncLog(NULL);
+
+static bool AsyncLogPush(AsyncLog* q, const log4cxx::LoggerPtr& logger, const log4cxx::spi::LoggingEventPtr& event) {
+	size_t pos = q->enqueuePos.load(std::memory_order_relaxed);
+	LogSlot* slot;
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		size_t seq = slot->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (q->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+		} else if (dif < 0) {
+			return false;	// full
+		} else {
+			pos = q->enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+	slot->logger = logger;
+	slot->event = event;
+	slot->seq.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+// only called by the flush thread
+static bool AsyncLogPop(AsyncLog* q, log4cxx::LoggerPtr& logger, log4cxx::spi::LoggingEventPtr& event) {
+	size_t pos = q->dequeuePos.load(std::memory_order_relaxed);
+	LogSlot* slot = &q->slots[pos & q->mask];
+	if (slot->seq.load(std::memory_order_acquire) != pos + 1) return false;
+	logger = slot->logger;
+	event = slot->event;
+	slot->logger = 0;
+	slot->event = 0;
+	slot->seq.store(pos + q->mask + 1, std::memory_order_release);
+	q->dequeuePos.store(pos + 1, std::memory_order_relaxed);
+	return true;
+}
+
+static bool AsyncLogEmpty(AsyncLog* q) {
+	size_t pos = q->dequeuePos.load(std::memory_order_relaxed);
+	return q->slots[pos & q->mask].seq.load(std::memory_order_acquire) != pos + 1;
+}
+
+static void AsyncLogReportDropped(AsyncLog* q, log4cxx::helpers::Pool& pool) {
+	uint64_t dropped = q->dropped.load(std::memory_order_relaxed);
+	if (q->overflow != LOG_OVERFLOW_COUNT || dropped == q->droppedReported) return;
+	char msg[128];
+	sprintf(msg, "log queue full, %llu events dropped", (unsigned long long)(dropped - q->droppedReported));
+	q->droppedReported = dropped;
+	LOG4CXX_DECODE_CHAR(lsMsg, std::string(msg));
+	log4cxx::spi::LoggingEventPtr event(new log4cxx::spi::LoggingEvent(mainLogger->getName(), log4cxx::Level::getWarn(), lsMsg, log4cxx::spi::LocationInfo::getLocationUnavailable()));
+	mainLogger->callAppenders(event, pool);
+}
+
+static void AsyncLogRun(AsyncLog* q) {
+	log4cxx::helpers::Pool pool;
+	log4cxx::LoggerPtr logger;
+	log4cxx::spi::LoggingEventPtr event;
+	for (;;) {
+		size_t n = 0;
+		while (n < q->batchSize && AsyncLogPop(q, logger, event)) {
+			logger->callAppenders(event, pool);
+			n++;
+		}
+		if (n > 0) {
+			logger = 0;
+			event = 0;
+			q->written.fetch_add(n, std::memory_order_relaxed);
+			AsyncLogReportDropped(q, pool);
+			if (q->waiters.load() > 0) {
+				std::lock_guard<std::mutex> lock(q->mutex);
+				q->progress.notify_all();
+			}
+			continue;
+		}
+		if (q->stopping.load()) break;
+
+		// the lock makes the recheck and the wait atomic with respect to AsyncLogWakeup()
+		std::unique_lock<std::mutex> lock(q->mutex);
+		q->sleeping.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (AsyncLogEmpty(q) && !q->stopping.load()) {
+			q->wakeup.wait_for(lock, std::chrono::milliseconds(100));
+		}
+		q->sleeping.store(false);
+	}
+	std::lock_guard<std::mutex> lock(q->mutex);
+	q->exited.store(true);
+	q->progress.notify_all();
+}
+
+static void AsyncLogWakeup(AsyncLog* q) {
+	// pairs with the fence in AsyncLogRun(): either the flush thread sees the new event or we see it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (q->sleeping.load()) {
+		std::lock_guard<std::mutex> lock(q->mutex);
+		q->wakeup.notify_one();
+	}
+}
+
+// waits until everything queued before the call has been appended
+static void AsyncLogFlush(AsyncLog* q) {
+	// slots are popped in order, so once written reaches the claimed positions every 
+	// event pushed before this call has been appended (enqueued lags behind them)
+	uint64_t target = q->enqueuePos.load();
+	AsyncLogWakeup(q);
+	std::unique_lock<std::mutex> lock(q->mutex);
+	q->waiters++;
+	while (q->written.load() < target && !q->exited.load()) {
+		q->wakeup.notify_one();
+		q->progress.wait_for(lock, std::chrono::milliseconds(10));
+	}
+	q->waiters--;
+}
+
+// stops the flush thread after it has drained the queue, called at exit
+static void AsyncLogStop() {
+	AsyncLog* q = asyncLog.load(std::memory_order_acquire);
+	if (q == NULL || q->stopping.exchange(true)) return;
+	{
+		std::lock_guard<std::mutex> lock(q->mutex);
+		q->wakeup.notify_one();
+	}
+	q->thread.join();
+}
+
+static void AsyncLogStart(size_t size, int overflow, size_t batchSize) {
+	size_t capacity = 2;
+	while (capacity < size) capacity <<= 1;
+
+	AsyncLog* q = new AsyncLog();
+	q->slots.reset(new LogSlot[capacity]);
+	for (size_t i = 0; i < capacity; i++) {
+		q->slots[i].seq.store(i, std::memory_order_relaxed);
+	}
+	q->mask = capacity - 1;
+	q->enqueuePos = 0;
+	q->dequeuePos = 0;
+	q->overflow = overflow;
+	q->batchSize = batchSize;
+	q->stopping = false;
+	q->exited = false;
+	q->sleeping = false;
+	q->waiters = 0;
+	q->enqueued = 0;
+	q->written = 0;
+	q->dropped = 0;
+	q->blocked = 0;
+	q->droppedReported = 0;
+	q->thread = std::thread(AsyncLogRun, q);
+	asyncLog.store(q, std::memory_order_release);
+	atexit(AsyncLogStop);
+}
+
+static void AsyncLogEnqueue(AsyncLog* q, const log4cxx::LoggerPtr& logger, const log4cxx::LevelPtr& level, const std::string& message) {
+	// the event is built here so that it keeps the caller's timestamp, thread and NDC/MDC
+	LOG4CXX_DECODE_CHAR(lsMsg, message);
+	log4cxx::spi::LoggingEventPtr event(new log4cxx::spi::LoggingEvent(logger->getName(), level, lsMsg, log4cxx::spi::LocationInfo::getLocationUnavailable()));
+
+	bool waited = false;
+	while (q->stopping.load() || !AsyncLogPush(q, logger, event)) {
+		if (q->stopping.load()) {
+			// shutting down, the flush thread may be gone already
+			log4cxx::helpers::Pool pool;
+			logger->callAppenders(event, pool);
+			return;
+		}
+		if (q->overflow != LOG_OVERFLOW_BLOCK) {
+			q->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		if (!waited) {
+			q->blocked.fetch_add(1, std::memory_order_relaxed);
+			waited = true;
+		}
+		std::unique_lock<std::mutex> lock(q->mutex);
+		q->waiters++;
+		q->wakeup.notify_one();
+		q->progress.wait_for(lock, std::chrono::milliseconds(1));
+		q->waiters--;
+	}
+	q->enqueued.fetch_add(1, std::memory_order_relaxed);
+	AsyncLogWakeup(q);
+}
+
+// logger handles by name; each Worker runs on its own thread so the cache needs no locking
+static thread_local std::unordered_map<std::string, log4cxx::LoggerPtr> loggerCache;
+
 LoggerPtr getLogger(const v8::FunctionCallbackInfo<v8::Value>& args) {
     Isolate* isolate = args.GetIsolate();
     HandleScope handle_scope(isolate);
@@ -59,142 +292,108 @@ LoggerPtr getLogger(const v8::FunctionCallbackInfo<v8::Value>& args) {
 	LoggerPtr logger = mainLogger;
 	if (args.Length() > 1 && args[1]->IsString()) {
 		v8::String::Utf8Value jsName(isolate,Handle<v8::String>::Cast(args[1]));
-		std::string name = std::string(*jsName);
+		std::string name = std::string(*jsName, jsName.length());
+		auto it = loggerCache.find(name);
+		if (it != loggerCache.end()) return it->second;
 		logger = log4cxx::Logger::getLogger(name.c_str());
+		loggerCache[name] = logger;
 	}
 	return logger;
 }
 
-static void LogTrace(const v8::FunctionCallbackInfo<v8::Value>& args)
+// the level is checked before the message is converted
+static void LogEvent(const v8::FunctionCallbackInfo<v8::Value>& args, const log4cxx::LevelPtr& level)
 {
     Isolate* isolate = args.GetIsolate();
     HandleScope handle_scope(isolate);
 	if (args.Length() == 0)
 	{		
 		Throw(isolate,"invalid arguments");
+		return;
 	} else if (!args[0]->IsString())
 	{
 		Throw(isolate,"invalid string argument");		
+		return;
 	}
 	
-	
-	if (mainLogger == NULL) {
+	if (!logReady.load(std::memory_order_acquire)) {
 		Throw(isolate,"Log module not initialized");
 		return;
 	}
 	
+	LoggerPtr logger = getLogger(args);
+	if (!logger->isEnabledFor(level)) return;
 	
 	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	TRACE(getLogger(args), *jsStr)
+	std::string message(*jsStr, jsStr.length());
+	AsyncLog* q = asyncLog.load(std::memory_order_acquire);
+	if (q != NULL) {
+		AsyncLogEnqueue(q, logger, level, message);
+	} else {
+		logger->forcedLog(level, message, LOG4CXX_LOCATION);
+	}
 }
 
-static void LogDebug(const v8::FunctionCallbackInfo<v8::Value>& args)
+static void LogTrace(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
-    Isolate* isolate = args.GetIsolate();
-    HandleScope handle_scope(isolate);
-   
-	if (args.Length() == 0)
-	{		
-		Throw(isolate,"invalid arguments");
-	} else if (!args[0]->IsString())
-	{
-		Throw(isolate,"invalid string argument");		
-	}
+	LogEvent(args, log4cxx::Level::getTrace());
+}
 
-	if (mainLogger == NULL) {
-		Throw(isolate,"Log module not initialized");
-		return;
-	}
-	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	
-	DEBUG(getLogger(args), *jsStr)
+static void LogDebug(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+	LogEvent(args, log4cxx::Level::getDebug());
 }
+
 static void LogInfo(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
-    Isolate* isolate = args.GetIsolate();
-    HandleScope handle_scope(isolate);
-   
-	if (args.Length() == 0)
-	{		
-		Throw(isolate,"invalid arguments");
-	} else if (!args[0]->IsString())
-	{
-		Throw(isolate,"invalid string argument");		
-	}
-	
-	
-	if (mainLogger == NULL) {
-		Throw(isolate,"Log module not initialized");
-		return;
-	}
-	
-	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	INFO(getLogger(args), *jsStr)
+	LogEvent(args, log4cxx::Level::getInfo());
 }
+
 static void LogWarn(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
-    Isolate* isolate = args.GetIsolate();
-    HandleScope handle_scope(isolate);
-   
-	if (args.Length() == 0)
-	{		
-		Throw(isolate,"invalid arguments");
-	} else if (!args[0]->IsString())
-	{
-		Throw(isolate,"invalid string argument");		
-	}
-	
-	
-	if (mainLogger == NULL) {
-		Throw(isolate,"Log module not initialized");
-		return;
-	}
-	
-	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	WARN(getLogger(args), *jsStr)
+	LogEvent(args, log4cxx::Level::getWarn());
 }
+
 static void LogError(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
-    Isolate* isolate = args.GetIsolate();
-    HandleScope handle_scope(isolate);
-   
-	if (args.Length() == 0)
-	{		
-		Throw(isolate,"invalid arguments");
-	} else if (!args[0]->IsString())
-	{
-		Throw(isolate,"invalid string argument");		
-	}
-	
-	if (mainLogger == NULL) {
-		Throw(isolate,"Log module not initialized");
-		return;
-	}
-	
-	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	ERROR(getLogger(args), *jsStr)
+	LogEvent(args, log4cxx::Level::getError());
 }
+
 static void LogFatal(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+	LogEvent(args, log4cxx::Level::getFatal());
+}
+
+static void LogFlush(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
     Isolate* isolate = args.GetIsolate();
     HandleScope handle_scope(isolate);
-   
-	if (args.Length() == 0)
-	{		
-		Throw(isolate,"invalid arguments");
-	} else if (!args[0]->IsString())
-	{
-		Throw(isolate,"invalid string argument");		
+	AsyncLog* q = asyncLog.load(std::memory_order_acquire);
+	if (q != NULL) {
+		AsyncLogFlush(q);
 	}
+}
 
-	if (mainLogger == NULL) {
-		Throw(isolate,"Log module not initialized");
-		return;
+// queue depth and counters of the async mode
+static void LogGetStats(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+	Local<Context> context = isolate->GetCurrentContext();
+
+	AsyncLog* q = asyncLog.load(std::memory_order_acquire);
+	Local<v8::Object> stats = v8::Object::New(isolate);
+	stats->Set(context, v8::String::NewFromUtf8(isolate, "async")TO_LOCAL_CHECKED, v8::Boolean::New(isolate, q != NULL)).FromJust();
+	if (q != NULL) {
+		size_t depth = q->enqueuePos.load() - q->dequeuePos.load();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "capacity")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)(q->mask + 1))).FromJust();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "depth")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)depth)).FromJust();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "enqueued")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)q->enqueued.load())).FromJust();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "written")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)q->written.load())).FromJust();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "dropped")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)q->dropped.load())).FromJust();
+		stats->Set(context, v8::String::NewFromUtf8(isolate, "blocked")TO_LOCAL_CHECKED, v8::Number::New(isolate, (double)q->blocked.load())).FromJust();
 	}
-	
-	
-	v8::String::Utf8Value jsStr(isolate,Handle<v8::String>::Cast(args[0]));
-	FATAL(getLogger(args), *jsStr)
+	args.GetReturnValue().Set(stats);
 }
 
 
@@ -203,20 +402,59 @@ static void LogInit(const v8::FunctionCallbackInfo<v8::Value>& args)
     Isolate* isolate = args.GetIsolate();
     HandleScope handle_scope(isolate);
 
-	if (args.Length() != 1)
+	if (args.Length() < 1 || args.Length() > 2)
 	{		
 		Throw(isolate,"invalid arguments");
+		return;
 	} else if (!args[0]->IsString())
 	{
 		Throw(isolate,"invalid string argument");		
+		return;
 	}
 	
 
-	if (mainLogger != NULL) {
+	if (logReady.load(std::memory_order_acquire)) {
 		Throw(isolate,"Log module already initialized");
 		return;
 	}
 	
+	// Log.init(configFile, {async: true, queueSize: 8192, overflow: 'block'|'drop'|'count', batchSize: 256})
+	bool async = false;
+	uint32_t queueSize = 8192;
+	uint32_t batchSize = 256;
+	int overflow = LOG_OVERFLOW_BLOCK;
+	if (args.Length() > 1 && args[1]->IsObject()) {
+		Local<Context> context = isolate->GetCurrentContext();
+		Local<v8::Object> options = Local<v8::Object>::Cast(args[1]);
+		Local<Value> value;
+		if (options->Get(context, v8::String::NewFromUtf8(isolate, "async")TO_LOCAL_CHECKED).ToLocal(&value)) {
+			async = value->BooleanValue(isolate);
+		}
+		if (options->Get(context, v8::String::NewFromUtf8(isolate, "queueSize")TO_LOCAL_CHECKED).ToLocal(&value) && value->IsUint32()) {
+			queueSize = value->Uint32Value(context).FromMaybe(queueSize);
+		}
+		if (options->Get(context, v8::String::NewFromUtf8(isolate, "batchSize")TO_LOCAL_CHECKED).ToLocal(&value) && value->IsUint32()) {
+			batchSize = value->Uint32Value(context).FromMaybe(batchSize);
+		}
+		if (options->Get(context, v8::String::NewFromUtf8(isolate, "overflow")TO_LOCAL_CHECKED).ToLocal(&value) && value->IsString()) {
+			v8::String::Utf8Value jsOverflow(isolate, value);
+			if (strcmp(*jsOverflow, "block") == 0) {
+				overflow = LOG_OVERFLOW_BLOCK;
+			} else if (strcmp(*jsOverflow, "drop") == 0) {
+				overflow = LOG_OVERFLOW_DROP;
+			} else if (strcmp(*jsOverflow, "count") == 0) {
+				overflow = LOG_OVERFLOW_COUNT;
+			} else {
+				Throw(isolate, "invalid overflow policy");
+				return;
+			}
+		}
+		if (queueSize == 0 || batchSize == 0) {
+			Throw(isolate, "invalid queue or batch size");
+			return;
+		}
+	}
+	
 	v8::String::Utf8Value jsConfigfile(isolate,Handle<v8::String>::Cast(args[0]));
 	char * configFile = *jsConfigfile;
 	
@@ -229,8 +467,19 @@ static void LogInit(const v8::FunctionCallbackInfo<v8::Value>& args)
 		return;		
 	}
 	
+	std::lock_guard<std::mutex> lock(logInitMutex);
+	if (logReady.load(std::memory_order_relaxed)) {
+		// another Worker got here first
+		Throw(isolate,"Log module already initialized");
+		return;
+	}
 	log4cxx::PropertyConfigurator::configure(configFile);
+	// set before the flush thread starts, it logs the dropped events through it
 	mainLogger = log4cxx::Logger::getRootLogger();	
+	if (async) {
+		AsyncLogStart(queueSize, overflow, batchSize);
+	}
+	logReady.store(true, std::memory_order_release);
 }
 
 
@@ -248,7 +497,7 @@ static void LogSetLevel(const v8::FunctionCallbackInfo<v8::Value>& args)
 		Throw(isolate,"invalid level");		
 	}
 	
-	if (mainLogger == NULL) {
+	if (!logReady.load(std::memory_order_acquire)) {
 		Throw(isolate,"Log module not initialized");
 		return;
 	}
@@ -273,7 +522,7 @@ static void LogIsLevel(const v8::FunctionCallbackInfo<v8::Value>& args)
 		Throw(isolate,"invalid level");		
 	}
 	
-	if (mainLogger == NULL) {
+	if (!logReady.load(std::memory_order_acquire)) {
 		Throw(isolate,"Log module not initialized");
 		return;
 	}
@@ -298,6 +547,8 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	log->Set(v8::String::NewFromUtf8(isolate, "init")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LogInit));
 	log->Set(v8::String::NewFromUtf8(isolate, "setLevel")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LogSetLevel));
 	log->Set(v8::String::NewFromUtf8(isolate, "isLevel")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LogIsLevel));
+	log->Set(v8::String::NewFromUtf8(isolate, "flush")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LogFlush));
+	log->Set(v8::String::NewFromUtf8(isolate, "getStats")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, LogGetStats));
 
 	log->Set(v8::String::NewFromUtf8(isolate,"ALL")TO_LOCAL_CHECKED, v8::Integer::New(isolate, log4cxx::Level::ALL_INT));
 	log->Set(v8::String::NewFromUtf8(isolate,"OFF")TO_LOCAL_CHECKED, v8::Integer::New(isolate, log4cxx::Level::OFF_INT));	
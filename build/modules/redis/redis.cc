@@ -11,6 +11,8 @@ found in the LICENSE file.
 #include <string.h>
 #include "hiredis.h"
 #include <sstream>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 #include <Winsock2.h>
@@ -18,6 +20,7 @@ found in the LICENSE file.
 #endif
 
 #include "v8adapt.h"	
+#include "tinn_metrics.h"
 	
 #if defined(_WIN32)
   #define LIBRARY_API __declspec(dllexport)
@@ -33,6 +36,11 @@ using namespace v8;
 #define DEFAULT_HOST "127.0.0.1"
 #define DEFAULT_PORT 6379
 
+// how replies are returned to javascript
+#define REPLY_MODE_OBJECT 0 	// {type, string/integer/elements} wrapper objects
+#define REPLY_MODE_PLAIN 1		// plain values: strings, numbers, arrays, null, Error
+#define REPLY_MODE_BINARY 2		// like REPLY_MODE_PLAIN but bulk strings are ArrayBuffers
+
 
 typedef struct {
 	char *host;
@@ -42,9 +50,28 @@ typedef struct {
 typedef struct {
 	RedistConnectArgs * args;
 	redisContext * conn;	
+	int replyMode;
 	
+	// scratch space reused by every command to build the argv passed to hiredis
+	std::string argBuf;
+	std::vector<long> argOffsets;
+	std::vector<const char*> argv;
+	std::vector<size_t> argvlen;
 } RedisContext;
 
+// Metrics ids, registered in init()
+static int metricCommand = -1;
+static int metricPipeline = -1;
+static int metricPipelineCommands = -1;
+static int metricErrors = -1;
+
+// records the latency of a command and counts failed or error replies
+static void recordCommand(int64_t start, redisReply *reply)
+{
+	TinnMetricRecord(metricCommand, TinnMetricsNow() - start);
+	if (reply == NULL || reply->type == REDIS_REPLY_ERROR) TinnMetricAdd(metricErrors, 1);
+}
+
 static Local<Value> Throw(Isolate* isolate, const char* message) {
 	return isolate->ThrowException(v8::Exception::Error(String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
 }
@@ -113,15 +140,16 @@ Local<Object> getReplyObject(Isolate * isolate, redisReply *reply)
 		break;
 		case REDIS_REPLY_STATUS:
 		case REDIS_REPLY_STRING:
+		case REDIS_REPLY_ERROR:
 		{
 			//printf("redis reply string=%s\n", reply->str);
-			res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"string")TO_LOCAL_CHECKED, v8::String::NewFromUtf8(isolate,reply->str)TO_LOCAL_CHECKED);	
+			res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"string")TO_LOCAL_CHECKED, v8::String::NewFromUtf8(isolate,reply->str,NewStringType::kNormal,reply->len)TO_LOCAL_CHECKED);	
 		}
 		break;
 		case REDIS_REPLY_INTEGER:
 		{
 			//printf("redis reply integer=%d\n", reply->integer);
-			res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"integer")TO_LOCAL_CHECKED, v8::Integer::New(isolate,reply->integer));
+			res->Set(CONTEXT_ARG v8::String::NewFromUtf8(isolate,"integer")TO_LOCAL_CHECKED, v8::Number::New(isolate,(double)reply->integer));
 		}
 		break;
 		
@@ -136,7 +164,89 @@ Local<Object> getReplyObject(Isolate * isolate, redisReply *reply)
 	return res;
 }
 
+// converts a reply to a plain javascript value, errors are returned (not thrown) as Error objects
+Local<Value> getReplyValue(Isolate * isolate, Local<Context> context, redisReply *reply, bool binary)
+{
+	switch (reply->type)
+	{
+		case REDIS_REPLY_ARRAY:
+		{
+			Local<Array> elements = v8::Array::New(isolate,reply->elements);
+			for (unsigned int i= 0; i<reply->elements; i++)
+			{
+				elements->Set(context, i, getReplyValue(isolate, context, reply->element[i], binary)).FromJust();
+			}
+			return elements;
+		}
+		case REDIS_REPLY_STRING:
+		{
+			if (binary) {
+				Local<ArrayBuffer> buf = ArrayBuffer::New(isolate, reply->len);
+				if (reply->len > 0) memcpy(buf->GetContents().Data(), reply->str, reply->len);
+				return buf;
+			}
+			return v8::String::NewFromUtf8(isolate,reply->str,NewStringType::kNormal,reply->len)TO_LOCAL_CHECKED;
+		}
+		case REDIS_REPLY_STATUS:
+			return v8::String::NewFromUtf8(isolate,reply->str,NewStringType::kNormal,reply->len)TO_LOCAL_CHECKED;
+		case REDIS_REPLY_ERROR:
+			return v8::Exception::Error(v8::String::NewFromUtf8(isolate,reply->str,NewStringType::kNormal,reply->len)TO_LOCAL_CHECKED);
+		case REDIS_REPLY_INTEGER:
+			return v8::Number::New(isolate,(double)reply->integer);
+		default:
+			return v8::Null(isolate);
+	}
+}
+
+Local<Value> getReply(Isolate * isolate, RedisContext *ctx, redisReply *reply)
+{
+	if (ctx->replyMode == REPLY_MODE_OBJECT) return getReplyObject(isolate, reply);
+	return getReplyValue(isolate, isolate->GetCurrentContext(), reply, ctx->replyMode == REPLY_MODE_BINARY);
+}
+
+static void resetArgv(RedisContext *ctx)
+{
+	ctx->argBuf.clear();
+	ctx->argOffsets.clear();
+	ctx->argv.clear();
+	ctx->argvlen.clear();
+}
+
+// appends a command argument to ctx->argv without copying ArrayBuffer contents, strings 
+// and numbers are written as utf-8 in ctx->argBuf. Call finishArgv() before using ctx->argv 
+static bool addArgv(Isolate *isolate, RedisContext *ctx, Local<Value> value)
+{
+	if (value->IsArrayBufferView()) {
+		Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(value);
+		ctx->argv.push_back((const char*)view->Buffer()->GetContents().Data() + view->ByteOffset());
+		ctx->argvlen.push_back(view->ByteLength());
+		ctx->argOffsets.push_back(-1);
+	} else if (value->IsArrayBuffer()) {
+		ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(value)->GetContents();
+		ctx->argv.push_back((const char*)contents.Data());
+		ctx->argvlen.push_back(contents.ByteLength());
+		ctx->argOffsets.push_back(-1);
+	} else if (value->IsString() || value->IsNumber()) {
+		Local<String> str = value->ToString(isolate->GetCurrentContext())TO_LOCAL_CHECKED;
+		int len = str->Utf8Length(isolate);
+		size_t offset = ctx->argBuf.size();
+		ctx->argBuf.resize(offset + len);
+		if (len > 0) str->WriteUtf8(isolate, &ctx->argBuf[offset], len, NULL, String::NO_NULL_TERMINATION);
+		ctx->argv.push_back(NULL);
+		ctx->argvlen.push_back(len);
+		ctx->argOffsets.push_back((long)offset);
+	} else {
+		return false;
+	}
+	return true;
+}
 
+static void finishArgv(RedisContext *ctx)
+{
+	for (size_t i=0; i<ctx->argv.size(); i++) {
+		if (ctx->argOffsets[i] >= 0) ctx->argv[i] = ctx->argBuf.data() + ctx->argOffsets[i];
+	}
+}
 
 static void HiredisConnect(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
@@ -223,19 +333,21 @@ static void HiredisGetReply(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		} 
 	}
 	
-	redisReply *reply;
+	redisReply *reply = NULL;
+	int64_t start = TinnMetricsNow();
 #ifdef _WIN32	
 	redisGetReply(ctx->conn,(void**)&reply);
 #else	
 	redisGetReply(ctx->conn,&reply);
 #endif	
+	recordCommand(start, reply);
 	if (reply == NULL)
 	{
 		Throw(isolate, "error connecting to redis");
 		return;
 	}
 		
-	Handle<Object> res = getReplyObject(isolate, reply);
+	Handle<Value> res = getReply(isolate, ctx, reply);
 	freeReplyObject(reply);
 	args.GetReturnValue().Set(res);	
 
@@ -268,6 +380,7 @@ static void HiredisCommand(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		} 
 	}
 	
+	int64_t start = TinnMetricsNow();
 	redisReply *reply = (redisReply *)redisCommand(ctx->conn, cmd);
 	
 	//we might have got a NULL reply because redis got disconnected, in this case re-try connecting
@@ -280,6 +393,7 @@ static void HiredisCommand(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		}
 		reply = (redisReply *)redisCommand(ctx->conn, cmd);
 	}
+	recordCommand(start, reply);
 	
 	if (reply == NULL)
 	{
@@ -287,7 +401,7 @@ static void HiredisCommand(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		return;
 	}
 
-	Handle<Object> res = getReplyObject(isolate, reply);
+	Handle<Value> res = getReply(isolate, ctx, reply);
 	freeReplyObject(reply);
 	args.GetReturnValue().Set (res);	
   
@@ -300,59 +414,201 @@ static void HiredisCommandArgv(const v8::FunctionCallbackInfo<v8::Value>& args)
 	if (args.Length() == 0)
 	{		
 		Throw(isolate,"invalid arguments");
+		return;
 	} 
 	
+	RedisContext * ctx = GetRedisContextFromInternalField(isolate, args.Holder());
 	int num = args.Length();
-	const char * redisArgs[num];
-	stringstream ss;
+	resetArgv(ctx);
 	for (int i= 0; i<num; i++)
 	{
-		if (!args[i]->IsString())
+		if (!addArgv(isolate, ctx, args[i]))
 		{
 			Throw(isolate,"invalid arguments");
+			return;
 		}
-		v8::String::Utf8Value jsArg(isolate,Handle<v8::String>::Cast(args[i]));
-		redisArgs[i] = strdup(*jsArg);
-		printf("redis arg %i: %s\n", i, redisArgs[i]);
-		ss << redisArgs[i] << " ";
 	}
+	finishArgv(ctx);
 	
-	RedisContext * ctx = GetRedisContextFromInternalField(isolate, args.Holder());
 	if (!ctx->conn || ctx->conn->err)
 	{
 		if (!connect(isolate, args)) {
 			Throw(isolate, "error connecting to redis");
-			for (int i= 0; i<num; i++) free((char*)redisArgs[i]);
 			return;
 		} 
 	}
 
-	redisReply *reply = (redisReply *)redisCommandArgv(ctx->conn, num, redisArgs, NULL);
+	int64_t start = TinnMetricsNow();
+	redisReply *reply = (redisReply *)redisCommandArgv(ctx->conn, num, ctx->argv.data(), ctx->argvlen.data());
 	//we might have got a NULL reply because redis got disconnected, in this case re-try connecting
 	if (reply == NULL )
 	{
 		if (!connect(isolate, args))
 		{  
 			Throw(isolate, "error connecting to redis");
-			for (int i= 0; i<num; i++) free((char*)redisArgs[i]);
 			return;
 		}
-		reply = (redisReply *)redisCommandArgv(ctx->conn, num, redisArgs, NULL);
+		reply = (redisReply *)redisCommandArgv(ctx->conn, num, ctx->argv.data(), ctx->argvlen.data());
 	}
+	recordCommand(start, reply);
 	
 	if (reply == NULL)
 	{
 		Throw(isolate, "redis error when executing command");
-		for (int i= 0; i<num; i++) free((char*)redisArgs[i]);
 		return;
 	}
-	Handle<Object> res = getReplyObject(isolate, reply);
+	Handle<Value> res = getReply(isolate, ctx, reply);
 	freeReplyObject(reply);
-	for (int i= 0; i<num; i++) free((char*)redisArgs[i]);
 	args.GetReturnValue().Set(res);	
   
 }
 
+// appends all the commands of a pipeline to the output buffer of the connection
+static bool appendPipeline(Isolate *isolate, RedisContext *ctx, Local<Array> cmds)
+{
+	Local<Context> context = isolate->GetCurrentContext();
+	for (unsigned int i=0; i<cmds->Length(); i++)
+	{
+		Local<Value> cmd = cmds->Get(context, i)TO_LOCAL_CHECKED;
+		if (!cmd->IsArray()) return false;
+		Local<Array> cmdArgs = Local<Array>::Cast(cmd);
+		unsigned int num = cmdArgs->Length();
+		if (num == 0) return false;
+		
+		resetArgv(ctx);
+		for (unsigned int j=0; j<num; j++)
+		{
+			if (!addArgv(isolate, ctx, cmdArgs->Get(context, j)TO_LOCAL_CHECKED)) return false;
+		}
+		finishArgv(ctx);
+		if (redisAppendCommandArgv(ctx->conn, num, ctx->argv.data(), ctx->argvlen.data()) != REDIS_OK) return false;
+	}
+	return true;
+}
+
+// writes out the output buffer; on failure *wrote tells whether some of it already reached the server
+static bool flushPipeline(redisContext *c, bool *wrote)
+{
+	size_t pending = sdslen(c->obuf);
+	int done = 0;
+	*wrote = false;
+	do {
+		if (redisBufferWrite(c, &done) != REDIS_OK) {
+			*wrote = sdslen(c->obuf) < pending;
+			return false;
+		}
+	} while (!done);
+	return true;
+}
+
+/*
+ Redis.pipeline([[cmd, arg1, ...], ...], {binary: bool}) sends all the commands at once and 
+ returns an array with one plain value per command (see getReplyValue). When binary is true 
+ bulk strings are returned as ArrayBuffers.
+*/
+static void HiredisPipeline(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+	Local<Context> context = isolate->GetCurrentContext();
+	
+	if (args.Length() == 0 || !args[0]->IsArray())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	} 
+	
+	RedisContext * ctx = GetRedisContextFromInternalField(isolate, args.Holder());
+	Local<Array> cmds = Local<Array>::Cast(args[0]);
+	unsigned int num = cmds->Length();
+	
+	bool binary = ctx->replyMode == REPLY_MODE_BINARY;
+	if (args.Length() > 1 && args[1]->IsObject())
+	{
+		Local<Value> jsBinary = Local<Object>::Cast(args[1])->Get(context, v8::String::NewFromUtf8(isolate,"binary")TO_LOCAL_CHECKED)TO_LOCAL_CHECKED;
+		if (!jsBinary->IsUndefined()) binary = jsBinary->BooleanValue(isolate);
+	}
+	
+	if (!ctx->conn || ctx->conn->err)
+	{
+		if (!connect(isolate, args)) {
+			Throw(isolate, "error connecting to redis");
+			return;
+		} 
+	}
+	
+	int64_t start = TinnMetricsNow();
+	if (!appendPipeline(isolate, ctx, cmds))
+	{
+		//part of the pipeline may be sitting in the output buffer, drop the connection
+		redisFree(ctx->conn);
+		ctx->conn = NULL;
+		Throw(isolate, "invalid pipeline command");
+		return;
+	}
+	
+	bool wrote;
+	if (!flushPipeline(ctx->conn, &wrote))
+	{
+		//the connection was probably stale: re-try once on a new one, but only if the server
+		//can't have received any of the commands, a resend would run them twice
+		bool retry = !wrote && connect(isolate, args) && appendPipeline(isolate, ctx, cmds) && 
+			flushPipeline(ctx->conn, &wrote);
+		if (!retry)
+		{
+			std::string err = std::string("redis error when sending pipeline: ") + 
+				(ctx->conn ? ctx->conn->errstr : "connection failed");
+			if (ctx->conn) {
+				redisFree(ctx->conn);
+				ctx->conn = NULL;
+			}
+			TinnMetricAdd(metricErrors, 1);
+			Throw(isolate, err.c_str());
+			return;
+		}
+	}
+	
+	Local<Array> res = v8::Array::New(isolate, num);
+	for (unsigned int i=0; i<num; i++)
+	{
+		redisReply *reply = NULL;
+		if (redisGetReply(ctx->conn, (void**)&reply) != REDIS_OK || reply == NULL)
+		{
+			//the commands were sent and may have run, so they are not re-sent
+			std::string err = std::string("redis error when executing pipeline: ") + ctx->conn->errstr;
+			redisFree(ctx->conn);
+			ctx->conn = NULL;
+			TinnMetricAdd(metricErrors, 1);
+			Throw(isolate, err.c_str());
+			return;
+		}
+		if (reply->type == REDIS_REPLY_ERROR) TinnMetricAdd(metricErrors, 1);
+		res->Set(context, i, getReplyValue(isolate, context, reply, binary)).FromJust();
+		freeReplyObject(reply);
+	}
+	TinnMetricRecord(metricPipeline, TinnMetricsNow() - start);
+	TinnMetricAdd(metricPipelineCommands, num);
+	args.GetReturnValue().Set(res);	
+}
+
+static void HiredisSetReplyMode(const v8::FunctionCallbackInfo<v8::Value>& args) {
+	Isolate* isolate = args.GetIsolate();
+	HandleScope handle_scope(isolate);  
+	
+	if (args.Length() != 1 || !args[0]->IsUint32())
+	{		
+		Throw(isolate,"invalid arguments");
+		return;
+	} 
+	uint32_t mode = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(REPLY_MODE_OBJECT);
+	if (mode > REPLY_MODE_BINARY)
+	{		
+		Throw(isolate,"invalid reply mode");
+		return;
+	} 
+	RedisContext * ctx = GetRedisContextFromInternalField(isolate, args.Holder());
+	ctx->replyMode = mode;
+}
+
 
 
 extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &context) 
@@ -365,6 +621,8 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	hiredis->Set(v8::String::NewFromUtf8(isolate, "commandArgv")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HiredisCommandArgv));
 	hiredis->Set(v8::String::NewFromUtf8(isolate, "appendCommand")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HiredisAppendCommand));
 	hiredis->Set(v8::String::NewFromUtf8(isolate, "getReply")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HiredisGetReply));
+	hiredis->Set(v8::String::NewFromUtf8(isolate, "pipeline")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HiredisPipeline));
+	hiredis->Set(v8::String::NewFromUtf8(isolate, "setReplyMode")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, HiredisSetReplyMode));
 		
 	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_STRING")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REDIS_REPLY_STRING));
 	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_ARRAY")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REDIS_REPLY_ARRAY));
@@ -372,6 +630,9 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_NIL")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REDIS_REPLY_NIL));
 	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_STATUS")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REDIS_REPLY_STATUS));
 	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_ERROR")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REDIS_REPLY_ERROR));
+	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_MODE_OBJECT")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REPLY_MODE_OBJECT));
+	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_MODE_PLAIN")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REPLY_MODE_PLAIN));
+	hiredis->Set(v8::String::NewFromUtf8(isolate,"REPLY_MODE_BINARY")TO_LOCAL_CHECKED, v8::Integer::New(isolate, REPLY_MODE_BINARY));
 	
 	hiredis->SetInternalFieldCount(1);  
 	
@@ -380,6 +641,7 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	ctx->args = new RedistConnectArgs();
 	ctx->args->port = DEFAULT_PORT;
 	ctx->args->host = strdup(DEFAULT_HOST);	
+	ctx->replyMode = REPLY_MODE_OBJECT;
 	instance->SetAlignedPointerInInternalField(0, ctx);		
 	context->Global()->Set(context,v8::String::NewFromUtf8(isolate,"Redis")TO_LOCAL_CHECKED, instance).FromJust();	
 	return true;
@@ -387,6 +649,12 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 
 extern "C" bool LIBRARY_API init() 
 {
+	// times are in microseconds
+	TinnMetricsInit();
+	metricCommand = TinnMetric("redis.command_us", TINN_METRIC_HISTOGRAM);
+	metricPipeline = TinnMetric("redis.pipeline_us", TINN_METRIC_HISTOGRAM);
+	metricPipelineCommands = TinnMetric("redis.pipeline_commands", TINN_METRIC_COUNTER);
+	metricErrors = TinnMetric("redis.errors", TINN_METRIC_COUNTER);
 	return true;
 }
 
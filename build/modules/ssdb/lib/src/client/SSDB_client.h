@@ -82,6 +82,11 @@ public:
 	//virtual bool pipelinedRequest(const std::vector<std::string> &req) = 0;
 	//virtual bool pipelineExec() = 0;
 	virtual bool  pipelinedCommands(const std::vector<std::vector<std::string>> &req) = 0;
+	/// Sends (and flushes) all the requests without waiting for the responses.
+	/// On failure *wrote (if not NULL) tells whether some bytes already reached the server
+	virtual bool pipelineSend(const std::vector<std::vector<std::string>> &reqs, bool *wrote = NULL) = 0;
+	/// Waits for count responses, if resps is not NULL the responses are appended to it
+	virtual bool pipelineRecv(int count, std::vector<std::vector<std::string>> *resps) = 0;
 
 	virtual const std::vector<std::string>* request(const std::vector<std::string> &req) = 0;
 	virtual const std::vector<std::string>* request(const std::string &cmd) = 0;
@@ -104,22 +104,38 @@ bool ClientImpl::pipelineExec(){
 */
 
 bool  ClientImpl::pipelinedCommands(const std::vector<std::vector<std::string>> &reqs){
-	int count = 0;
-	int numCmd = reqs.size();
-	
+	return pipelineSend(reqs) && pipelineRecv(reqs.size(), NULL);
+}
+
+bool ClientImpl::pipelineSend(const std::vector<std::vector<std::string>> &reqs, bool *wrote){
+	if (wrote) *wrote = false;
 	for(std::vector<std::vector<std::string>>::const_iterator it=reqs.begin(); it!=reqs.end(); it++){
-		const std::vector<std::string> req = *it;
-		if (link->send(req) == -1) return false;
+		if (link->send(*it) == -1) return false;
 	}
 	
+	int pending = link->output->size();
 	if(link->flush() == -1){
+		// a partial write means the server may have received (and run) some of the requests
+		if (wrote) *wrote = link->output->size() < pending;
 		return false;  
 	}
-	
-	for (int i=0; i<numCmd;i++) {
-		link->response();
+	return true;
+}
+
+bool ClientImpl::pipelineRecv(int count, std::vector<std::vector<std::string>> *resps){
+	for (int i=0; i<count;i++) {
+		const std::vector<Bytes> *packet = link->response();
+		if(packet == NULL){
+			return false;
+		}
+		if (resps == NULL) continue;
+		resps->push_back(std::vector<std::string>());
+		std::vector<std::string> &resp = resps->back();
+		resp.reserve(packet->size());
+		for(std::vector<Bytes>::const_iterator it=packet->begin(); it!=packet->end(); it++){
+			resp.push_back(it->String());
+		}
 	}
-	
 	return true;
 }
 
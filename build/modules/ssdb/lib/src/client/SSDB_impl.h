@@ -22,6 +22,8 @@ public:
 //	virtual bool pipelineExec();
 //	virtual void pipelineStart() ;
 	virtual bool  pipelinedCommands(const std::vector<std::vector<std::string>> &req) ;
+	virtual bool pipelineSend(const std::vector<std::vector<std::string>> &reqs, bool *wrote = NULL);
+	virtual bool pipelineRecv(int count, std::vector<std::vector<std::string>> *resps);
 
 	virtual const std::vector<std::string>* request(const std::vector<std::string> &req);
 	virtual const std::vector<std::string>* request(const std::string &cmd);
@@ -12,6 +12,9 @@ found in the LICENSE file.
 #include <sstream>
 #include <algorithm>  
 #include <math.h>
+#include <map>
+#include <vector>
+#include <string>
 
 
 #ifdef _WIN32
@@ -22,6 +25,7 @@ found in the LICENSE file.
 #include "SSDB_client.h"
 
 #include "v8adapt.h"	
+#include "tinn_metrics.h"
 	
 #if defined(_WIN32)
   #define LIBRARY_API __declspec(dllexport)
@@ -100,6 +104,12 @@ typedef struct {
 	int regionNum;
 } SSDBContext;
 
+// Metrics ids, registered in init()
+static int metricCommand = -1;
+static int metricPipeline = -1;
+static int metricPipelineCommands = -1;
+static int metricErrors = -1;
+
 static Local<Value> Throw(Isolate* isolate, const char* message) {
   //printf("SSDB throw exception: %s\n" , message);
   return isolate->ThrowException(v8::Exception::Error(String::NewFromUtf8(isolate, message, NewStringType::kNormal).ToLocalChecked()));
@@ -333,6 +343,7 @@ static void SSDBNodeRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Instance * inst = NULL;
   Local<Object> res = Object::New(isolate);	
   const std::vector<std::string> *resp;
+  TinnMetricsTimer timer(metricCommand);
 
 ///
     Handle<External> field = Handle<External>::Cast(args.Holder()->GetInternalField(0));
@@ -346,6 +357,7 @@ static void SSDBNodeRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		   resp = inst->conn->request(reqArgs);
 		   ssdb::Status s = ssdb::Status(resp);
 		   if (s.server_error()) {
+			   TinnMetricAdd(metricErrors, 1);
 			   delete inst->conn;		   
 			   inst->conn = NULL;
 			   continue;
@@ -366,6 +378,7 @@ static void SSDBNodeRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		   }   
 	   }
   } while(inst!=NULL); 
+  TinnMetricAdd(metricErrors, 1);
   Throw(isolate, "ssdb connect error");  
 }	
 	
@@ -396,6 +409,7 @@ static void SSDBRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Instance * inst = NULL;
   Local<Object> res = Object::New(isolate);	
   const std::vector<std::string> *resp;
+  TinnMetricsTimer timer(metricCommand);
  
   do {
 	   inst = GetSSDBInstance(args.Holder(), *jsCmd);
@@ -403,6 +417,7 @@ static void SSDBRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		   resp = inst->conn->request(reqArgs);
 		   ssdb::Status s = ssdb::Status(resp);
 		   if (s.server_error()) {
+			   TinnMetricAdd(metricErrors, 1);
 			   delete inst->conn;
 			   inst->conn = NULL;
 			   continue;
@@ -423,6 +438,7 @@ static void SSDBRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		   }   
 	   }
   } while(inst!=NULL); 
+  TinnMetricAdd(metricErrors, 1);
   Throw(isolate, "ssdb connect error");  
 }	
 		   
@@ -430,6 +446,73 @@ static void SSDBRequest(const v8::FunctionCallbackInfo<v8::Value>& args) {
 
 
 
+// commands of a pipeline that hash to the same region 
+struct RegionBatch {
+	std::vector<std::vector<std::string>> cmds;
+	std::vector<int> indexes;	// position of each command in the javascript array
+	std::vector<std::vector<std::string>> resps;
+	Instance * inst;
+};
+
+typedef std::map<SlotRegion *, RegionBatch> RegionBatches;
+
+/*
+ Sends the batch to the first available instance of the region. It only fails over to the next
+ instance when nothing was written to the failed one: once the server may have received part of 
+ the batch, resending it could run non-idempotent commands (incr, qpush, ...) twice, so NULL is 
+ returned instead.
+*/
+Instance * SendRegionBatch(SlotRegion * region, RegionBatch &batch) {
+	Instance * inst = NULL;
+	while ((inst = GetSSDBInstanceFromRegion(region)) != NULL) {
+		bool wrote;
+		if (inst->conn->pipelineSend(batch.cmds, &wrote)) return inst;
+		delete inst->conn;
+		inst->conn = NULL;
+		if (wrote) return NULL;
+	}
+	return NULL;
+}
+
+/*
+ Runs the per-region batches concurrently: every batch is written to its region before 
+ waiting for any response, so the servers process them in parallel and the whole call 
+ takes about the time of the slowest region. A region that fails while reading the 
+ responses is not retried, since the server may already have run the commands: batch.resps
+ only holds the responses read before the failure. batch.inst is NULL for regions that 
+ could not be reached or failed.
+*/
+void RunRegionBatches(RegionBatches &batches) {
+	for (auto& kv : batches) {
+		kv.second.inst = SendRegionBatch(kv.first, kv.second);
+	}
+	for (auto& kv : batches) {
+		RegionBatch &batch = kv.second;
+		if (batch.inst == NULL) continue;
+		if (batch.inst->conn->pipelineRecv(batch.cmds.size(), &batch.resps)) continue;
+		delete batch.inst->conn;
+		batch.inst->conn = NULL;
+		batch.inst = NULL;
+	}
+}
+
+Local<Array> GetResponseArray(Isolate* isolate, Local<Context> context, const std::vector<std::string> &resp) {
+	Local<Array> eRes = v8::Array::New(isolate,resp.size());
+	for (unsigned int i= 0; i<resp.size(); i++)
+	{
+		eRes->Set(context, i, v8::String::NewFromUtf8(isolate,resp[i].data(),NewStringType::kNormal,resp[i].size())TO_LOCAL_CHECKED).FromJust();
+	}
+	return eRes;
+}
+
+/*
+ SSDB.pipelinedCommands(name, [[cmd, key, ...], ...]) groups the commands by region and runs the
+ regions concurrently. Returns one {status, response} object per command in the original order:
+ status is 1 when the command succeeded, 0 when it failed (response holds the ssdb reply, 
+ starting with the response code) and -1 when its outcome is unknown: no instance of the region
+ could be reached, or the connection failed before its response was read (the command may or
+ may not have been applied, it is not resent).
+*/
 static void SSDBPipelinedCommands(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
      HandleScope outer_scope(isolate);
@@ -440,60 +523,141 @@ static void SSDBPipelinedCommands(const v8::FunctionCallbackInfo<v8::Value>& arg
 	 Throw(isolate, "invalid arguments");
 	  return;
   }	
-  v8::String::Utf8Value jsArg1(isolate, Handle<v8::String>::Cast(args[0]));	  
-  char * arg1 = *jsArg1;
 
   Handle<Array> cmds = Handle<v8::Array>::Cast(args[1]);
   int num = cmds->Length();
-  //std::vector<std::vector <std::string>> commands;
-  std::map<SlotRegion *, std::vector<std::vector <std::string>>> clientCommands;
+  RegionBatches batches;
   
   for (int i= 0; i<num; i++)
   {
 	  if (!cmds->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED ->IsArray())
 	  {
 		Throw(isolate,"invalid arguments");
+		return;
 	  }
 	  Handle<Array> cmd = Handle<Array>::Cast(cmds->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED);
 	  std::vector <std::string> command;
 	  int n = cmd->Length();
-	  SlotRegion * sr = NULL;
+	  if (n < 2) 
+	  {
+		Throw(isolate,"invalid arguments: each command must have a key");
+		return;
+	  }
 	  for (int j= 0; j<n; j++)  {
-		  if (! cmd->Get(CONTEXT_ARG j)TO_LOCAL_CHECKED ->IsString()) Throw(isolate,"invalid arguments");
-		  v8::String::Utf8Value jsCmd(isolate, Handle<v8::String>::Cast(cmd->Get(CONTEXT_ARG j)TO_LOCAL_CHECKED));
-		  command.push_back(*jsCmd);
-		  if (j==1) {
-			v8::String::Utf8Value jsKey(isolate, Handle<v8::String>::Cast(cmd->Get(CONTEXT_ARG j)TO_LOCAL_CHECKED));
-			//inst = GetSSDBInstance(args.Holder(), *jsKey);
-			sr = GetSSDBRegion(args.Holder(), *jsKey);
-			//printf("got client from key=%s --> %p\n", *jsKey, client);
+		  if (! cmd->Get(CONTEXT_ARG j)TO_LOCAL_CHECKED ->IsString()) 
+		  {
+			  Throw(isolate,"invalid arguments");
+			  return;
 		  }
+		  v8::String::Utf8Value jsCmd(isolate, Handle<v8::String>::Cast(cmd->Get(CONTEXT_ARG j)TO_LOCAL_CHECKED));
+		  command.push_back(std::string(*jsCmd, jsCmd.length()));
 	  }
-	  if (sr!=NULL) {
-		clientCommands[sr].push_back(command);  
-	  }
-	  //commands.push_back(command);
+	  RegionBatch &batch = batches[GetSSDBRegion(args.Holder(), (char*)command[1].c_str())];
+	  batch.cmds.push_back(command);  
+	  batch.indexes.push_back(i);
   }  
 	  
-  for (auto& kv : clientCommands) {
-	//printf("client=%p commands: %d\n", kv.first, kv.second.size());  
-	Instance * inst = NULL;
-
-	do {
-		inst = GetSSDBInstanceFromRegion(kv.first);
-		if (inst != NULL)  {
-			bool res = inst->conn->pipelinedCommands(kv.second);
-			if (!res) {
-			   delete inst->conn;		   
-			   inst->conn = NULL;
-			   continue;				
-			} else {
-				break;
-			}
+  int64_t start = TinnMetricsNow();
+  RunRegionBatches(batches);
+  TinnMetricRecord(metricPipeline, TinnMetricsNow() - start);
+  TinnMetricAdd(metricPipelineCommands, num);
+  
+  Local<Array> results = v8::Array::New(isolate, num);
+  Local<String> statusKey = v8::String::NewFromUtf8(isolate,"status")TO_LOCAL_CHECKED;
+  Local<String> responseKey = v8::String::NewFromUtf8(isolate,"response")TO_LOCAL_CHECKED;
+  for (auto& kv : batches) {
+	RegionBatch &batch = kv.second;
+	for (unsigned int i=0; i<batch.indexes.size(); i++) {
+		Local<Object> res = Object::New(isolate);
+		if (i >= batch.resps.size()) {
+			TinnMetricAdd(metricErrors, 1);
+			res->Set(context, statusKey, v8::Integer::New(isolate,-1)).FromJust();
+		} else {
+			ssdb::Status s = ssdb::Status(&batch.resps[i]);
+			res->Set(context, statusKey, v8::Integer::New(isolate,s.ok() ? 1 : 0)).FromJust();
+			res->Set(context, responseKey, GetResponseArray(isolate, context, batch.resps[i])).FromJust();
 		}
-	} while(inst!=NULL); 
+		results->Set(context, batch.indexes[i], res).FromJust();
+	}
+  }
+  args.GetReturnValue().Set(results);
+}
+
+/*
+ SSDB.multiGet([key1, key2, ...]) splits the keys by region, sends one multi_get per region 
+ concurrently and returns the values in the order of the keys (null for keys that were not 
+ found). Throws if a region could not be reached or answered with an error.
+*/
+static void SSDBMultiGet(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+    HandleScope outer_scope(isolate);
+    Local<Context> context = isolate->GetCurrentContext();
+    Context::Scope context_scope(context);
+  if (args.Length() != 1 || !args[0]->IsArray())
+  {
+	 Throw(isolate, "invalid arguments");
+	  return;
+  }	
+  
+  Handle<Array> keys = Handle<v8::Array>::Cast(args[0]);
+  int num = keys->Length();
+  std::vector<std::string> keyList;
+  keyList.reserve(num);
+  RegionBatches batches;
+  
+  for (int i= 0; i<num; i++)
+  {
+	  if (!keys->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED ->IsString())
+	  {
+		Throw(isolate,"invalid arguments");
+		return;
+	  }
+	  v8::String::Utf8Value jsKey(isolate, Handle<v8::String>::Cast(keys->Get(CONTEXT_ARG i)TO_LOCAL_CHECKED));
+	  keyList.push_back(std::string(*jsKey, jsKey.length()));
+	  RegionBatch &batch = batches[GetSSDBRegion(args.Holder(), *jsKey)];
+	  if (batch.cmds.empty()) {
+		  batch.cmds.push_back(std::vector<std::string>());
+		  batch.cmds[0].push_back("multi_get");
+	  }
+	  batch.cmds[0].push_back(keyList.back());
   }  
   
+  int64_t start = TinnMetricsNow();
+  RunRegionBatches(batches);
+  TinnMetricRecord(metricPipeline, TinnMetricsNow() - start);
+  TinnMetricAdd(metricPipelineCommands, (int64_t)batches.size());
+  
+  std::map<std::string, const std::string *> values;
+  for (auto& kv : batches) {
+	RegionBatch &batch = kv.second;
+	if (batch.resps.empty()) {
+		TinnMetricAdd(metricErrors, 1);
+		Throw(isolate, "ssdb connect error");
+		return;
+	}
+	const std::vector<std::string> &resp = batch.resps[0];
+	ssdb::Status s = ssdb::Status(&resp);
+	if (!s.ok()) {
+		TinnMetricAdd(metricErrors, 1);
+		Throw(isolate, ("ssdb multi_get error: " + s.code()).c_str());
+		return;
+	}
+	for (unsigned int i=1; i+1<resp.size(); i+=2) {
+		values[resp[i]] = &resp[i+1];
+	}
+  }
+  
+  Local<Array> results = v8::Array::New(isolate, num);
+  for (int i= 0; i<num; i++)
+  {
+	  std::map<std::string, const std::string *>::iterator it = values.find(keyList[i]);
+	  if (it == values.end()) {
+		  results->Set(context, i, v8::Null(isolate)).FromJust();
+	  } else {
+		  results->Set(context, i, v8::String::NewFromUtf8(isolate,it->second->data(),NewStringType::kNormal,it->second->size())TO_LOCAL_CHECKED).FromJust();
+	  }
+  }
+  args.GetReturnValue().Set(results);
 }
 
 extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &context) 
@@ -510,6 +674,7 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 	ssdb->Set(v8::String::NewFromUtf8(isolate, "nodeRequest")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, SSDBNodeRequest));
 
 	ssdb->Set(v8::String::NewFromUtf8(isolate, "pipelinedCommands")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, SSDBPipelinedCommands));
+	ssdb->Set(v8::String::NewFromUtf8(isolate, "multiGet")TO_LOCAL_CHECKED, FunctionTemplate::New(isolate, SSDBMultiGet));
 		
 	
 	ssdb->SetInternalFieldCount(1);  
@@ -525,5 +690,11 @@ extern "C" bool LIBRARY_API attach(Isolate* isolate, v8::Local<v8::Context> &con
 
 extern "C" bool LIBRARY_API init() 
 {
+	// times are in microseconds
+	TinnMetricsInit();
+	metricCommand = TinnMetric("ssdb.command_us", TINN_METRIC_HISTOGRAM);
+	metricPipeline = TinnMetric("ssdb.pipeline_us", TINN_METRIC_HISTOGRAM);
+	metricPipelineCommands = TinnMetric("ssdb.pipeline_commands", TINN_METRIC_COUNTER);
+	metricErrors = TinnMetric("ssdb.errors", TINN_METRIC_COUNTER);
 	return true;
 }
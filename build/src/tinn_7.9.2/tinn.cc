@@ -18,8 +18,11 @@ credits:
 #include <sys/stat.h>
 
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iomanip>
+#include <list>
+#include <sstream>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -32,6 +35,7 @@ credits:
 #include "include/libplatform/v8-tracing.h"
 #include "include/v8-inspector.h"
 #include "src/api/api-inl.h"
+#include "src/base/bits.h"
 #include "src/base/cpu.h"
 #include "src/base/logging.h"
 #include "src/base/platform/platform.h"
@@ -69,6 +73,8 @@ credits:
 
 #if !defined(_WIN32) && !defined(_WIN64)
 #include <unistd.h>  // NOLINT
+#include <fcntl.h>
+#include <sys/mman.h>
 #else
 #include <windows.h>  // NOLINT
 #endif                // !defined(_WIN32) && !defined(_WIN64)
@@ -591,8 +597,7 @@ static void OSFileSize(const v8::FunctionCallbackInfo<v8::Value>& args) {
 		args.GetReturnValue().Set(v8::Integer::New(isolate, -1));	
 		return;
 	}
-	int size = (int)st.st_size;	
-	args.GetReturnValue().Set(v8::Integer::New(isolate, size));	
+	args.GetReturnValue().Set(v8::Number::New(isolate, (double)st.st_size));	
 	
 }
 
@@ -738,6 +743,70 @@ Local<String> ReadFile(Isolate* isolate, const char* name) {
   return result;
 }
 
+// ArrayBuffer based I/O: data is copied straight between the file and the
+// backing store of an ArrayBuffer, SharedArrayBuffer or typed array/DataView.
+
+static bool GetBufferBytes(Local<Value> value, char** data, size_t* length)
+{
+	if (value->IsArrayBufferView()) {
+		Local<ArrayBufferView> view = Local<ArrayBufferView>::Cast(value);
+		*data = static_cast<char*>(view->Buffer()->GetContents().Data()) + view->ByteOffset();
+		*length = view->ByteLength();
+	} else if (value->IsArrayBuffer()) {
+		ArrayBuffer::Contents contents = Local<ArrayBuffer>::Cast(value)->GetContents();
+		*data = static_cast<char*>(contents.Data());
+		*length = contents.ByteLength();
+	} else if (value->IsSharedArrayBuffer()) {
+		SharedArrayBuffer::Contents contents = Local<SharedArrayBuffer>::Cast(value)->GetContents();
+		*data = static_cast<char*>(contents.Data());
+		*length = contents.ByteLength();
+	} else {
+		return false;
+	}
+	return true;
+}
+
+// buffer at args[index], optionally narrowed by the offset and length at args[range] and args[range+1]
+static bool GetBufferRange(Isolate* isolate, const v8::FunctionCallbackInfo<v8::Value>& args, int index, int range, char** data, size_t* length)
+{
+	if (args.Length() <= index || !GetBufferBytes(args[index], data, length))
+	{
+		Throw(isolate, "invalid buffer argument");
+		return false;
+	}
+	Local<Context> context = isolate->GetCurrentContext();
+	int64_t offset = 0;
+	int64_t count = -1;
+	if (args.Length() > range && !args[range]->IsUndefined())
+	{
+		if (!args[range]->IsNumber()) {
+			Throw(isolate, "invalid offset");
+			return false;
+		}
+		offset = args[range]->IntegerValue(context).FromMaybe(-1);
+	}
+	if (args.Length() > range + 1 && !args[range + 1]->IsUndefined())
+	{
+		if (!args[range + 1]->IsNumber()) {
+			Throw(isolate, "invalid length");
+			return false;
+		}
+		count = args[range + 1]->IntegerValue(context).FromMaybe(-1);
+		if (count < 0) {
+			Throw(isolate, "invalid length");
+			return false;
+		}
+	}
+	if (offset < 0 || (size_t)offset > *length || (count >= 0 && (size_t)count > *length - (size_t)offset))
+	{
+		Throw(isolate, "offset or length out of range");
+		return false;
+	}
+	*data += offset;
+	*length = count >= 0 ? (size_t)count : *length - (size_t)offset;
+	return true;
+}
+
 static void OSReadFile(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
     Isolate* isolate = args.GetIsolate();
@@ -770,24 +839,35 @@ static void OSWriteFile(const v8::FunctionCallbackInfo<v8::Value>& args)
 		Throw(isolate, "invalid arguments");
 		return;
 	}
-	if (!args[0]->IsString() || !args[1]->IsString())
+	if (!args[0]->IsString() || !(args[1]->IsString() || args[1]->IsArrayBuffer() ||
+		args[1]->IsSharedArrayBuffer() || args[1]->IsArrayBufferView()))
 	{
 		Throw(isolate, "invalid arguments");				
 		return;
 	}
 	
 	v8::String::Utf8Value jsName(isolate,Local<v8::String>::Cast(args[0]));
-	v8::String::Utf8Value jsContent(isolate,Local<v8::String>::Cast(args[1]));
-	char * buf = *jsContent;
 	FILE * f = fopen(*jsName, "wb");
 	if (!f)
 	{
 		args.GetReturnValue().Set(v8::Boolean::New(isolate,false));
 		return;
 	}
-	fwrite(buf , 1 , strlen(buf) , f);
-	fclose(f);
-	args.GetReturnValue().Set(v8::Boolean::New(isolate,true));		
+	bool ok;
+	if (args[1]->IsString()) {
+		v8::String::Utf8Value jsContent(isolate,Local<v8::String>::Cast(args[1]));
+		char * buf = *jsContent;
+		size_t len = strlen(buf);
+		ok = fwrite(buf , 1 , len , f) == len;
+	} else {
+		// binary content is written as is, straight from the backing store
+		char * buf;
+		size_t len;
+		GetBufferBytes(args[1], &buf, &len);
+		ok = len == 0 || fwrite(buf , 1 , len , f) == len;
+	}
+	ok = fclose(f) == 0 && ok;
+	args.GetReturnValue().Set(v8::Boolean::New(isolate,ok));		
 	
 }
 
@@ -1038,7 +1118,8 @@ static void OSWritebytes(const v8::FunctionCallbackInfo<v8::Value>& args)
     Context::Scope context_scope(context);
 
 
-	if (args.Length() < 2 || !args[0]->IsUint32() || !args[1]->IsArray())
+	if (args.Length() < 2 || !args[0]->IsUint32() || !(args[1]->IsArray() || args[1]->IsArrayBuffer() ||
+		args[1]->IsSharedArrayBuffer() || args[1]->IsArrayBufferView()))
 	{
 		Throw(isolate, "invalid arguments");
 		return;
@@ -1051,6 +1132,17 @@ static void OSWritebytes(const v8::FunctionCallbackInfo<v8::Value>& args)
 		Throw(isolate, "File descriptor not found");
 		return;
 	}
+
+	if (!args[1]->IsArray())
+	{
+		// buffers skip the per element conversion
+		char * data;
+		size_t length;
+		GetBufferBytes(args[1], &data, &length);
+		size_t written = length > 0 ? fwrite(data, 1, length, ctx->handles[fd]) : 0;
+		args.GetReturnValue().Set(v8::Number::New(isolate, (double)written));
+		return;
+	}
 	
 	Local<Array> jsBytes = Local<Array>::Cast(args[1]);
 	BYTE * buf = new BYTE[jsBytes->Length()];
@@ -1191,6 +1283,453 @@ static void OSWriteString(const v8::FunctionCallbackInfo<v8::Value>& args)
 
 
 
+// os functions taking or returning ArrayBuffers
+
+static FILE* GetOSFile(Isolate* isolate, const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+	if (args.Length() == 0 || !args[0]->IsUint32())
+	{
+		Throw(isolate, "invalid file descriptor");
+		return NULL;
+	}
+	unsigned int fd = args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0L);
+	OSContext *ctx = GetOSContext(isolate, args.Holder());
+	std::map<unsigned int, FILE*>::iterator it = ctx->handles.find(fd);
+	if (it == ctx->handles.end())
+	{
+		Throw(isolate, "File descriptor not found");
+		return NULL;
+	}
+	return it->second;
+}
+
+// a buffer that is about to be filled by a read does not need to be zeroed first
+static Local<ArrayBuffer> NewUninitializedArrayBuffer(Isolate* isolate, size_t length, char** data)
+{
+	if (length == 0) {
+		*data = NULL;
+		return ArrayBuffer::New(isolate, 0);
+	}
+	*data = static_cast<char*>(Shell::array_buffer_allocator->AllocateUninitialized(length));
+	if (*data == NULL) return Local<ArrayBuffer>();
+	return ArrayBuffer::New(isolate, *data, length, ArrayBufferCreationMode::kInternalized);
+}
+
+static bool ReadFully(FILE* f, char* data, size_t length, size_t* bytesRead)
+{
+	*bytesRead = 0;
+	while (*bytesRead < length) {
+		size_t n = fread(data + *bytesRead, 1, length - *bytesRead, f);
+		if (n == 0) return !ferror(f);
+		*bytesRead += n;
+	}
+	return true;
+}
+
+// reads and writes at an absolute position without moving the stream position
+static int64_t PositionalIO(FILE* f, char* data, size_t length, int64_t position, bool write)
+{
+	// pending stdio writes must reach the file first
+	fflush(f);
+#ifdef _WIN32
+	// ReadFile/WriteFile with an OVERLAPPED offset move the pointer of a synchronous handle,
+	// so it is saved and put back
+	HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+	LARGE_INTEGER zero, saved;
+	zero.QuadPart = 0;
+	if (!SetFilePointerEx(h, zero, &saved, FILE_CURRENT)) return -1;
+	size_t done = 0;
+	bool failed = false;
+	while (done < length) {
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(ov));
+		int64_t pos = position + (int64_t)done;
+		ov.Offset = (DWORD)pos;
+		ov.OffsetHigh = (DWORD)(pos >> 32);
+		DWORD chunk = (DWORD)std::min(length - done, (size_t)(1 << 30));
+		DWORD n = 0;
+		BOOL ok = write ? WriteFile(h, data + done, chunk, &n, &ov) : ReadFile(h, data + done, chunk, &n, &ov);
+		if (!ok) {
+			failed = write || GetLastError() != ERROR_HANDLE_EOF;
+			break;
+		}
+		if (n == 0) break;
+		done += n;
+	}
+	SetFilePointerEx(h, saved, NULL, FILE_BEGIN);
+	return failed && done == 0 ? -1 : (int64_t)done;
+#else
+	size_t done = 0;
+	while (done < length) {
+		ssize_t n = write ? pwrite(fileno(f), data + done, length - done, position + done)
+			: pread(fileno(f), data + done, length - done, position + done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return done > 0 ? (int64_t)done : -1;
+		if (n == 0) break;
+		done += n;
+	}
+	return (int64_t)done;
+#endif
+}
+
+// os.readBuffer(fd, count): reads up to count bytes into a new ArrayBuffer
+static void OSReadBuffer(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	FILE* f = GetOSFile(isolate, args);
+	if (!f) return;
+	if (args.Length() < 2 || !args[1]->IsNumber())
+	{
+		Throw(isolate, "count argument is invalid");
+		return;
+	}
+	int64_t count = args[1]->IntegerValue(isolate->GetCurrentContext()).FromMaybe(-1);
+	if (count < 0)
+	{
+		Throw(isolate, "count argument is invalid");
+		return;
+	}
+
+	// count is an upper bound: don't allocate past what is left in a regular file
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0 && (st.st_mode & S_IFREG))
+	{
+#ifdef _WIN32
+		int64_t position = _ftelli64(f);
+#else
+		int64_t position = (int64_t)ftello(f);
+#endif
+		if (position >= 0) count = std::min(count, std::max((int64_t)st.st_size - position, (int64_t)0));
+	}
+	else
+	{
+		// pipes and devices: read in bounded chunks until count bytes or the end of the stream
+		std::vector<char> chunks;
+		size_t bytesRead = 0;
+		bool ok = true;
+		while (ok && bytesRead < (size_t)count)
+		{
+			size_t chunk = std::min((size_t)count - bytesRead, (size_t)(64 * 1024));
+			chunks.resize(bytesRead + chunk);
+			size_t n;
+			ok = ReadFully(f, chunks.data() + bytesRead, chunk, &n);
+			bytesRead += n;
+			if (n < chunk) break;
+		}
+		if (!ok)
+		{
+			Throw(isolate, "read failed");
+			return;
+		}
+		char* data;
+		Local<ArrayBuffer> buffer = NewUninitializedArrayBuffer(isolate, bytesRead, &data);
+		if (buffer.IsEmpty())
+		{
+			Throw(isolate, "out of memory");
+			return;
+		}
+		if (bytesRead > 0) memcpy(data, chunks.data(), bytesRead);
+		args.GetReturnValue().Set(buffer);
+		return;
+	}
+
+	char* data;
+	Local<ArrayBuffer> buffer = NewUninitializedArrayBuffer(isolate, (size_t)count, &data);
+	if (buffer.IsEmpty())
+	{
+		Throw(isolate, "out of memory");
+		return;
+	}
+	size_t bytesRead;
+	if (!ReadFully(f, data, (size_t)count, &bytesRead))
+	{
+		Throw(isolate, "read failed");
+		return;
+	}
+	if (bytesRead < (size_t)count)
+	{
+		// the file shrank since fstat
+		char* exact;
+		Local<ArrayBuffer> result = NewUninitializedArrayBuffer(isolate, bytesRead, &exact);
+		if (result.IsEmpty())
+		{
+			Throw(isolate, "out of memory");
+			return;
+		}
+		if (bytesRead > 0) memcpy(exact, data, bytesRead);
+		buffer = result;
+	}
+	args.GetReturnValue().Set(buffer);
+}
+
+// os.readInto(fd, buffer[, offset[, length]]): fills an existing buffer, returns the bytes read
+static void OSReadInto(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	FILE* f = GetOSFile(isolate, args);
+	if (!f) return;
+	char* data;
+	size_t length;
+	if (!GetBufferRange(isolate, args, 1, 2, &data, &length)) return;
+	size_t bytesRead;
+	if (!ReadFully(f, data, length, &bytesRead))
+	{
+		Throw(isolate, "read failed");
+		return;
+	}
+	args.GetReturnValue().Set(v8::Number::New(isolate, (double)bytesRead));
+}
+
+// os.writeBuffer(fd, buffer[, offset[, length]]): returns the bytes written
+static void OSWriteBuffer(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	FILE* f = GetOSFile(isolate, args);
+	if (!f) return;
+	char* data;
+	size_t length;
+	if (!GetBufferRange(isolate, args, 1, 2, &data, &length)) return;
+	size_t written = length > 0 ? fwrite(data, 1, length, f) : 0;
+	args.GetReturnValue().Set(v8::Number::New(isolate, (double)written));
+}
+
+static void OSPositional(const v8::FunctionCallbackInfo<v8::Value>& args, bool write)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	FILE* f = GetOSFile(isolate, args);
+	if (!f) return;
+	if (args.Length() < 3 || !args[2]->IsNumber())
+	{
+		Throw(isolate, "invalid position");
+		return;
+	}
+	int64_t position = args[2]->IntegerValue(isolate->GetCurrentContext()).FromMaybe(-1);
+	if (position < 0)
+	{
+		Throw(isolate, "invalid position");
+		return;
+	}
+	char* data;
+	size_t length;
+	if (!GetBufferRange(isolate, args, 1, 3, &data, &length)) return;
+	int64_t n = length > 0 ? PositionalIO(f, data, length, position, write) : 0;
+	if (n < 0)
+	{
+		Throw(isolate, write ? "pwrite failed" : "pread failed");
+		return;
+	}
+	args.GetReturnValue().Set(v8::Number::New(isolate, (double)n));
+}
+
+// os.pread(fd, buffer, position[, offset[, length]]): returns the bytes read, the stream position is not changed
+static void OSPread(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+	OSPositional(args, false);
+}
+
+// os.pwrite(fd, buffer, position[, offset[, length]]): returns the bytes written, the stream position is not changed
+static void OSPwrite(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+	OSPositional(args, true);
+}
+
+// os.readFileBuffer(path): the whole file as an ArrayBuffer, undefined if it can't be read
+static void OSReadFileBuffer(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	if (args.Length() == 0 || !args[0]->IsString())
+	{
+		Throw(isolate, "invalid argument");
+		return;
+	}
+	v8::String::Utf8Value jsName(isolate,Local<v8::String>::Cast(args[0]));
+	FILE* f = fopen(*jsName, "rb");
+	if (!f) return;
+	struct stat st;
+	if (fstat(fileno(f), &st) != 0 || (st.st_mode & S_IFDIR))
+	{
+		fclose(f);
+		return;
+	}
+	char* data;
+	Local<ArrayBuffer> buffer = NewUninitializedArrayBuffer(isolate, (size_t)st.st_size, &data);
+	if (buffer.IsEmpty())
+	{
+		fclose(f);
+		Throw(isolate, "out of memory");
+		return;
+	}
+	size_t bytesRead;
+	bool ok = ReadFully(f, data, (size_t)st.st_size, &bytesRead);
+	fclose(f);
+	if (!ok || bytesRead != (size_t)st.st_size) return;
+	args.GetReturnValue().Set(buffer);
+}
+
+/*
+ os.mmap(path[, shared]) maps a whole file into an ArrayBuffer. By default the
+ mapping is private (copy-on-write): writes from javascript are allowed but
+ never reach the file. With shared set to true the file is opened read/write
+ and changes are written back. The mapping is released when the ArrayBuffer is
+ garbage collected, or right away with os.munmap(buffer).
+ Caveats: if the file is truncated while the buffer is in use, touching the
+ pages past the new end raises SIGBUS and kills the process, so only map files
+ that are not rewritten in place. Mapped buffers can't be transferred with
+ postMessage (the mapping belongs to the sending isolate and would be unmapped
+ under the receiver), they are rejected there; copy the bytes instead.
+*/
+struct MappedBuffer {
+	void* data;
+	size_t length;
+	bool mapped;
+	Global<ArrayBuffer> handle;
+};
+
+static base::LazyMutex mappedBuffersMutex;
+static std::unordered_map<void*, MappedBuffer*> mappedBuffers;
+
+static bool IsMappedBuffer(void* data)
+{
+	if (data == NULL) return false;
+	base::MutexGuard lock_guard(mappedBuffersMutex.Pointer());
+	return mappedBuffers.find(data) != mappedBuffers.end();
+}
+
+static void* MapFile(const char* path, bool shared, size_t* length)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, shared ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		*length = 0;
+		CloseHandle(file);
+		return NULL;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, shared ? PAGE_READWRITE : PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (mapping == NULL) return NULL;
+	void* data = MapViewOfFile(mapping, shared ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	*length = (size_t)size.QuadPart;
+	return data;
+#else
+	int fd = open(path, shared ? O_RDWR : O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+		*length = 0;
+		close(fd);
+		return NULL;
+	}
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return NULL;
+	*length = (size_t)st.st_size;
+	return data;
+#endif
+}
+
+static void UnmapFile(void* data, size_t length)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, length);
+#endif
+}
+
+static void MappedBufferWeakCallback(const v8::WeakCallbackInfo<MappedBuffer>& data)
+{
+	MappedBuffer* mb = data.GetParameter();
+	{
+		base::MutexGuard lock_guard(mappedBuffersMutex.Pointer());
+		if (mb->mapped) {
+			mappedBuffers.erase(mb->data);
+			UnmapFile(mb->data, mb->length);
+		}
+	}
+	mb->handle.Reset();
+	delete mb;
+}
+
+static void OSMmap(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	if (args.Length() == 0 || !args[0]->IsString())
+	{
+		Throw(isolate, "invalid argument");
+		return;
+	}
+	bool shared = args.Length() > 1 && args[1]->BooleanValue(isolate);
+	v8::String::Utf8Value jsName(isolate,Local<v8::String>::Cast(args[0]));
+	size_t length = (size_t)-1;
+	void* data = MapFile(*jsName, shared, &length);
+	if (data == NULL)
+	{
+		if (length == 0) {
+			// empty files can't be mapped
+			args.GetReturnValue().Set(ArrayBuffer::New(isolate, 0));
+			return;
+		}
+		Throw(isolate, (std::string("Error mapping file ") + *jsName).c_str());
+		return;
+	}
+
+	Local<ArrayBuffer> buffer = ArrayBuffer::New(isolate, data, length, ArrayBufferCreationMode::kExternalized);
+	MappedBuffer* mb = new MappedBuffer();
+	mb->data = data;
+	mb->length = length;
+	mb->mapped = true;
+	mb->handle.Reset(isolate, buffer);
+	mb->handle.SetWeak(mb, MappedBufferWeakCallback, v8::WeakCallbackType::kParameter);
+	{
+		base::MutexGuard lock_guard(mappedBuffersMutex.Pointer());
+		mappedBuffers[data] = mb;
+	}
+	args.GetReturnValue().Set(buffer);
+}
+
+// os.munmap(buffer): releases a mapping from os.mmap now, the buffer becomes detached
+static void OSMunmap(const v8::FunctionCallbackInfo<v8::Value>& args)
+{
+    Isolate* isolate = args.GetIsolate();
+    HandleScope handle_scope(isolate);
+
+	if (args.Length() == 0 || !args[0]->IsArrayBuffer())
+	{
+		Throw(isolate, "invalid argument");
+		return;
+	}
+	Local<ArrayBuffer> buffer = Local<ArrayBuffer>::Cast(args[0]);
+	void* data = buffer->GetContents().Data();
+	base::MutexGuard lock_guard(mappedBuffersMutex.Pointer());
+	std::unordered_map<void*, MappedBuffer*>::iterator it = mappedBuffers.find(data);
+	if (data == NULL || it == mappedBuffers.end())
+	{
+		args.GetReturnValue().Set(false);
+		return;
+	}
+	buffer->Detach();
+	UnmapFile(it->second->data, it->second->length);
+	it->second->mapped = false;
+	mappedBuffers.erase(it);
+	args.GetReturnValue().Set(true);
+}
+
 static void OSGetHostname(const v8::FunctionCallbackInfo<v8::Value>& args)
 {
     Isolate* isolate = args.GetIsolate();
@@ -1540,6 +2079,296 @@ void Shell::StoreInCodeCache(Isolate* isolate, Local<Value> source,
                                      ScriptCompiler::CachedData::BufferOwned));
 }
 
+// Process-wide code cache used for every script tinn compiles (.init.js,
+// load(), require(), JS.load and Worker scripts). Entries are keyed by V8
+// version, file path, mtime, size and a hash of the source and are shared by
+// all isolates. With --code-cache-dir (or TINN_CODE_CACHE_DIR) they are also
+// persisted on disk so that restarts skip parsing as well. The in-memory map
+// is an LRU bounded by kMaxMemoryBytes; on disk there is one file per script
+// path, so an edited script replaces its previous entry.
+class PersistentCodeCache {
+ public:
+  typedef std::vector<uint8_t> Entry;
+
+  // Compiling short scripts is cheaper than hashing and looking them up.
+  static const int kMinSourceLength = 1024;
+  static const size_t kMaxMemoryBytes = 64 * 1024 * 1024;
+
+  static std::string Key(Isolate* isolate, Local<String> source,
+                         const char* path);
+  static std::shared_ptr<Entry> Lookup(const std::string& key);
+  static void Store(const std::string& key,
+                    const ScriptCompiler::CachedData* data);
+  static void Remove(const std::string& key);
+
+ private:
+  static uint64_t Hash(const char* data, size_t length);
+  static std::string FilePath(const std::string& key);
+  static std::string FileId(const std::string& key);
+  static std::shared_ptr<Entry> ReadFromDisk(const std::string& key);
+  static void WriteToDisk(const std::string& key, const Entry& entry);
+  static void InsertLocked(const std::string& key,
+                           const std::shared_ptr<Entry>& entry);
+  static void EraseLocked(std::string key);
+
+  struct Slot {
+    std::shared_ptr<Entry> entry;
+    std::list<std::string>::iterator lru;
+  };
+
+  static base::LazyMutex mutex_;
+  static std::unordered_map<std::string, Slot> entries_;
+  // Most recently used first.
+  static std::list<std::string> lru_;
+  static size_t memory_bytes_;
+  // Current key of every file id in entries_, to drop superseded versions.
+  static std::unordered_map<std::string, std::string> file_keys_;
+};
+
+base::LazyMutex PersistentCodeCache::mutex_;
+std::unordered_map<std::string, PersistentCodeCache::Slot>
+    PersistentCodeCache::entries_;
+std::list<std::string> PersistentCodeCache::lru_;
+size_t PersistentCodeCache::memory_bytes_ = 0;
+std::unordered_map<std::string, std::string> PersistentCodeCache::file_keys_;
+
+static const char kCodeCacheMagic[8] = {'T', 'I', 'N', 'N', 'J', 'S', 'C', '1'};
+static const uint32_t kCodeCacheMaxEntrySize = 256 * 1024 * 1024;
+
+uint64_t PersistentCodeCache::Hash(const char* data, size_t length) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string PersistentCodeCache::Key(Isolate* isolate, Local<String> source,
+                                     const char* path) {
+  v8::String::Utf8Value utf8(isolate, source);
+  char buf[64];
+  // The part before the '\0' identifies the script (its path, or its source
+  // when there is none) and names the file on disk, see FileId.
+  std::string key = V8::GetVersion();
+  key += '|';
+  struct stat st;
+  snprintf(buf, sizeof(buf), "|%016llx|%d",
+           static_cast<unsigned long long>(Hash(*utf8, utf8.length())),
+           utf8.length());
+  if (path != nullptr && stat(path, &st) == 0 &&
+      (st.st_mode & S_IFREG) != 0) {
+    key += path;
+    key += '\0';
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "%lld|%lld",
+             static_cast<long long>(st.st_mtime),
+             static_cast<long long>(st.st_size));
+    key += stamp;
+    key += buf;
+  } else {
+    key += buf;
+    key += '\0';
+  }
+  return key;
+}
+
+std::string PersistentCodeCache::FileId(const std::string& key) {
+  return key.substr(0, key.find('\0'));
+}
+
+std::string PersistentCodeCache::FilePath(const std::string& key) {
+  // One file per script: a new version overwrites the previous one.
+  std::string id = FileId(key);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.jsc",
+           static_cast<unsigned long long>(Hash(id.data(), id.size())));
+#ifdef _WIN32
+  return std::string(Shell::options.code_cache_dir) + "\\" + name;
+#else
+  return std::string(Shell::options.code_cache_dir) + "/" + name;
+#endif
+}
+
+std::shared_ptr<PersistentCodeCache::Entry> PersistentCodeCache::Lookup(
+    const std::string& key) {
+  {
+    base::MutexGuard lock_guard(mutex_.Pointer());
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      return it->second.entry;
+    }
+  }
+  std::shared_ptr<Entry> entry = ReadFromDisk(key);
+  if (entry) {
+    base::MutexGuard lock_guard(mutex_.Pointer());
+    InsertLocked(key, entry);
+  }
+  return entry;
+}
+
+void PersistentCodeCache::InsertLocked(const std::string& key,
+                                       const std::shared_ptr<Entry>& entry) {
+  std::string id = FileId(key);
+  auto previous = file_keys_.find(id);
+  if (previous != file_keys_.end()) EraseLocked(previous->second);
+  EraseLocked(key);
+  lru_.push_front(key);
+  Slot& slot = entries_[key];
+  slot.entry = entry;
+  slot.lru = lru_.begin();
+  file_keys_[id] = key;
+  memory_bytes_ += entry->size();
+  // Entries still in use by a compile stay alive through their shared_ptr.
+  while (memory_bytes_ > kMaxMemoryBytes && lru_.size() > 1) {
+    EraseLocked(lru_.back());
+  }
+}
+
+void PersistentCodeCache::EraseLocked(std::string key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) return;
+  memory_bytes_ -= it->second.entry->size();
+  lru_.erase(it->second.lru);
+  auto file = file_keys_.find(FileId(key));
+  if (file != file_keys_.end() && file->second == key) file_keys_.erase(file);
+  entries_.erase(it);
+}
+
+void PersistentCodeCache::Store(const std::string& key,
+                                const ScriptCompiler::CachedData* data) {
+  if (data == nullptr || data->length <= 0) return;
+  std::shared_ptr<Entry> entry =
+      std::make_shared<Entry>(data->data, data->data + data->length);
+  {
+    base::MutexGuard lock_guard(mutex_.Pointer());
+    InsertLocked(key, entry);
+  }
+  WriteToDisk(key, *entry);
+}
+
+void PersistentCodeCache::Remove(const std::string& key) {
+  {
+    base::MutexGuard lock_guard(mutex_.Pointer());
+    EraseLocked(key);
+  }
+  if (Shell::options.code_cache_dir != nullptr) {
+    remove(FilePath(key).c_str());
+  }
+}
+
+std::shared_ptr<PersistentCodeCache::Entry> PersistentCodeCache::ReadFromDisk(
+    const std::string& key) {
+  std::shared_ptr<Entry> entry;
+  if (Shell::options.code_cache_dir == nullptr) return entry;
+  FILE* file = fopen(FilePath(key).c_str(), "rb");
+  if (file == nullptr) return entry;
+
+  char magic[sizeof(kCodeCacheMagic)];
+  uint32_t key_length = 0;
+  uint32_t data_length = 0;
+  std::string stored_key;
+  if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+      memcmp(magic, kCodeCacheMagic, sizeof(magic)) == 0 &&
+      fread(&key_length, sizeof(key_length), 1, file) == 1 &&
+      key_length == key.size()) {
+    stored_key.resize(key_length);
+    if (fread(&stored_key[0], 1, key_length, file) == key_length &&
+        stored_key == key &&
+        fread(&data_length, sizeof(data_length), 1, file) == 1 &&
+        data_length > 0 && data_length <= kCodeCacheMaxEntrySize) {
+      entry = std::make_shared<Entry>(data_length);
+      if (fread(entry->data(), 1, data_length, file) != data_length) {
+        entry.reset();
+      }
+    }
+  }
+  fclose(file);
+  return entry;
+}
+
+void PersistentCodeCache::WriteToDisk(const std::string& key,
+                                      const Entry& entry) {
+  if (Shell::options.code_cache_dir == nullptr) return;
+  std::string path = FilePath(key);
+  // Write to a private file first so that concurrent writers (other Workers
+  // or processes) never expose a partial entry.
+  char suffix[64];
+  snprintf(suffix, sizeof(suffix), ".%d.%d.tmp",
+           base::OS::GetCurrentProcessId(), base::OS::GetCurrentThreadId());
+  std::string tmp_path = path + suffix;
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) return;
+  uint32_t key_length = static_cast<uint32_t>(key.size());
+  uint32_t data_length = static_cast<uint32_t>(entry.size());
+  bool ok = fwrite(kCodeCacheMagic, 1, sizeof(kCodeCacheMagic), file) ==
+                sizeof(kCodeCacheMagic) &&
+            fwrite(&key_length, sizeof(key_length), 1, file) == 1 &&
+            fwrite(key.data(), 1, key.size(), file) == key.size() &&
+            fwrite(&data_length, sizeof(data_length), 1, file) == 1 &&
+            fwrite(entry.data(), 1, entry.size(), file) == entry.size();
+  ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+  if (ok) remove(path.c_str());
+#endif
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+  }
+}
+
+MaybeLocal<Script> Shell::CompileWithCodeCache(Isolate* isolate,
+                                               Local<Context> context,
+                                               Local<String> source,
+                                               const ScriptOrigin& origin,
+                                               const char* path,
+                                               std::string* cache_key) {
+  cache_key->clear();
+  if (!options.use_code_cache ||
+      source->Length() < PersistentCodeCache::kMinSourceLength) {
+    ScriptCompiler::Source script_source(source, origin);
+    return ScriptCompiler::Compile(context, &script_source,
+                                   ScriptCompiler::kNoCompileOptions);
+  }
+
+  std::string key = PersistentCodeCache::Key(isolate, source, path);
+  MaybeLocal<Script> maybe_script;
+  // Keeps the cached bytes alive while V8 deserializes them.
+  std::shared_ptr<PersistentCodeCache::Entry> entry =
+      PersistentCodeCache::Lookup(key);
+  if (entry) {
+    ScriptCompiler::Source script_source(
+        source, origin,
+        new ScriptCompiler::CachedData(entry->data(),
+                                       static_cast<int>(entry->size())));
+    maybe_script = ScriptCompiler::Compile(context, &script_source,
+                                           ScriptCompiler::kConsumeCodeCache);
+    if (!script_source.GetCachedData()->rejected) return maybe_script;
+    // Produced by a different V8 build or with different flags; V8 has
+    // compiled from source instead, so just rebuild the entry.
+    PersistentCodeCache::Remove(key);
+  } else {
+    ScriptCompiler::Source script_source(source, origin);
+    maybe_script = ScriptCompiler::Compile(context, &script_source,
+                                           ScriptCompiler::kNoCompileOptions);
+  }
+
+  Local<Script> script;
+  if (maybe_script.ToLocal(&script)) {
+    // Store right away: many scripts (e.g. accept loops) never return.
+    UpdateCodeCache(script, key);
+    *cache_key = key;
+  }
+  return maybe_script;
+}
+
+void Shell::UpdateCodeCache(Local<Script> script, const std::string& key) {
+  std::unique_ptr<ScriptCompiler::CachedData> data(
+      ScriptCompiler::CreateCodeCache(script->GetUnboundScript()));
+  PersistentCodeCache::Store(key, data.get());
+}
+
 // Executes a string within the current v8 context.
 bool Shell::ExecuteString(Isolate* isolate, Local<String> source,
                           Local<Value> name, PrintResult print_result,
@@ -1580,6 +2409,8 @@ bool Shell::ExecuteString(Isolate* isolate, Local<String> source,
     MaybeLocal<Script> maybe_script;
     Local<Context> context(isolate->GetCurrentContext());
     ScriptOrigin origin(name);
+    v8::String::Utf8Value path(isolate, name);
+    std::string cache_key;
 
     if (options.compile_options == ScriptCompiler::kConsumeCodeCache) {
       ScriptCompiler::CachedData* cached_code =
@@ -1611,6 +2442,11 @@ bool Shell::ExecuteString(Isolate* isolate, Local<String> source,
       background_compile_thread.Join();
       maybe_script = v8::ScriptCompiler::Compile(
           context, background_compile_thread.streamed_source(), source, origin);
+    } else if (options.compile_options == ScriptCompiler::kNoCompileOptions &&
+               options.code_cache_options ==
+                   ShellOptions::CodeCacheOptions::kNoProduceCache) {
+      maybe_script = CompileWithCodeCache(isolate, context, source, origin,
+                                          *path, &cache_key);
     } else {
       ScriptCompiler::Source script_source(source, origin);
       maybe_script = ScriptCompiler::Compile(context, &script_source,
@@ -1633,6 +2469,10 @@ bool Shell::ExecuteString(Isolate* isolate, Local<String> source,
       delete cached_data;
     }
     maybe_result = script->Run(realm);
+    if (!cache_key.empty() && !maybe_result.IsEmpty()) {
+      // Refresh the entry so that it also covers lazily compiled functions.
+      UpdateCodeCache(script, cache_key);
+    }
     if (options.code_cache_options ==
         ShellOptions::CodeCacheOptions::kProduceCacheAfterExecute) {
       // Serialize and store it in memory for the next execution.
@@ -2173,6 +3013,7 @@ MaybeLocal<Context> Shell::CreateRealm(
 
     //attach os..
 	AddTINNOS(isolate, context);  
+	AddTINNMetrics(isolate, context);
 
     //attach modules
     for (auto it : gModules)
@@ -2527,6 +3368,7 @@ void Shell::Run(const v8::FunctionCallbackInfo<v8::Value>& args) {
     MaybeLocal<Script> maybe_script;
     Local<Context> context(isolate->GetCurrentContext());
     ScriptOrigin origin(String::NewFromUtf8(isolate, file.c_str(), NewStringType::kNormal).ToLocalChecked());
+    std::string cache_key;
 
     if (options.compile_options == ScriptCompiler::kConsumeCodeCache) {
       ScriptCompiler::CachedData* cached_code =
@@ -2558,6 +3400,11 @@ void Shell::Run(const v8::FunctionCallbackInfo<v8::Value>& args) {
       background_compile_thread.Join();
       maybe_script = v8::ScriptCompiler::Compile(
           context, background_compile_thread.streamed_source(), source, origin);
+    } else if (options.compile_options == ScriptCompiler::kNoCompileOptions &&
+               options.code_cache_options ==
+                   ShellOptions::CodeCacheOptions::kNoProduceCache) {
+      maybe_script = CompileWithCodeCache(isolate, context, source, origin,
+                                          file.c_str(), &cache_key);
     } else {
       ScriptCompiler::Source script_source(source, origin);
       maybe_script = ScriptCompiler::Compile(context, &script_source,
@@ -2580,6 +3427,10 @@ void Shell::Run(const v8::FunctionCallbackInfo<v8::Value>& args) {
       delete cached_data;
     }
     maybe_result = script->Run(realm);
+    if (!cache_key.empty() && !maybe_result.IsEmpty()) {
+      // Refresh the entry so that it also covers lazily compiled functions.
+      UpdateCodeCache(script, cache_key);
+    }
     if (options.code_cache_options ==
         ShellOptions::CodeCacheOptions::kProduceCacheAfterExecute) {
       // Serialize and store it in memory for the next execution.
@@ -2621,10 +3472,18 @@ void Shell::WorkerNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
 
   // d8 honors `options={type: string}`, which means the first argument is
   // not a filename but string of script to be run.
+  // tinn also honors `options={batch: number}`: onmessage then receives an
+  // array with up to `batch` messages that were queued at the same time.
   bool load_from_file = true;
+  int batch_size = 0;
   if (args.Length() > 1 && args[1]->IsObject()) {
     Local<Object> object = args[1].As<Object>();
     Local<Context> context = isolate->GetCurrentContext();
+    Local<Value> batch = GetValue(args.GetIsolate(), context, object, "batch");
+    if (batch->IsNumber()) {
+      batch_size = batch->Int32Value(context).FromMaybe(0);
+      if (batch_size < 0) batch_size = 0;
+    }
     Local<Value> value = GetValue(args.GetIsolate(), context, object, "type");
     if (value->IsString()) {
       Local<String> worker_type = value->ToString(context).ToLocalChecked();
@@ -2677,7 +3536,7 @@ void Shell::WorkerNew(const v8::FunctionCallbackInfo<v8::Value>& args) {
     // The C++ worker object's lifetime is shared between the Managed<Worker>
     // object on the heap, which the JavaScript object points to, and an
     // internal std::shared_ptr in the worker thread itself.
-    auto worker = std::make_shared<Worker>(*script);
+    auto worker = std::make_shared<Worker>(*script, batch_size);
     i::Isolate* i_isolate = reinterpret_cast<i::Isolate*>(isolate);
     const size_t kWorkerSizeEstimate = 4 * 1024 * 1024;  // stack + heap.
     i::Handle<i::Object> managed = i::Managed<Worker>::FromSharedPtr(
@@ -2722,7 +3581,14 @@ void Shell::WorkerGetMessage(const v8::FunctionCallbackInfo<v8::Value>& args) {
     return;
   }
 
-  std::unique_ptr<SerializationData> data = worker->GetMessage();
+  // getMessage(timeoutMs): a negative or missing timeout blocks, 0 polls.
+  double timeout_ms = -1;
+  if (args.Length() > 0 && args[0]->IsNumber()) {
+    timeout_ms =
+        args[0]->NumberValue(isolate->GetCurrentContext()).FromMaybe(-1);
+  }
+
+  std::unique_ptr<SerializationData> data = worker->GetMessage(timeout_ms);
   if (data) {
     Local<Value> value;
     if (Shell::DeserializeValue(isolate, std::move(data)).ToLocal(&value)) {
@@ -2731,6 +3597,45 @@ void Shell::WorkerGetMessage(const v8::FunctionCallbackInfo<v8::Value>& args) {
   }
 }
 
+void Shell::WorkerGetMessages(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Worker* worker = GetWorkerFromInternalField(isolate, args.Holder());
+  if (!worker) {
+    return;
+  }
+
+  // getMessages(max, timeoutMs): waits like getMessage() for the first
+  // message, then returns it together with whatever else is already queued.
+  int32_t max = 1024;
+  if (args.Length() > 0 && args[0]->IsNumber()) {
+    max = args[0]->Int32Value(context).FromMaybe(max);
+  }
+  if (max < 1) {
+    Throw(isolate, "Invalid argument");
+    return;
+  }
+  double timeout_ms = -1;
+  if (args.Length() > 1 && args[1]->IsNumber()) {
+    timeout_ms = args[1]->NumberValue(context).FromMaybe(-1);
+  }
+
+  std::vector<std::unique_ptr<SerializationData>> messages;
+  worker->GetMessages(static_cast<size_t>(max), timeout_ms, &messages);
+  Local<Array> result = Array::New(isolate, static_cast<int>(messages.size()));
+  for (size_t i = 0; i < messages.size(); i++) {
+    Local<Value> value;
+    if (!Shell::DeserializeValue(isolate, std::move(messages[i]))
+             .ToLocal(&value)) {
+      return;
+    }
+    result->Set(context, static_cast<uint32_t>(i), value).FromJust();
+  }
+  args.GetReturnValue().Set(result);
+}
+
 void Shell::WorkerTerminate(const v8::FunctionCallbackInfo<v8::Value>& args) {
   Isolate* isolate = args.GetIsolate();
   HandleScope handle_scope(isolate);
@@ -2937,6 +3842,653 @@ Local<String> Shell::Stringify(Isolate* isolate, Local<Value> value) {
   return result.ToLocalChecked().As<String>();
 }
 
+// Process-wide metrics, exposed to scripts as the Metrics object and to
+// native modules through the tinn_Metrics* exports. Every thread (the main
+// one and each Worker) updates its own shard of relaxed atomics, so recording
+// never takes a lock or shares a cache line with another isolate; snapshots
+// add the shards up. Histograms are log-linear: 8 sub-buckets per power of
+// two (about 12% relative error) for values up to 2^40.
+class Metrics {
+ public:
+  enum Kind { kCounter = 0, kGauge = 1, kHistogram = 2 };
+
+  static const int kMaxMetrics = 1024;
+  static const int kSubBucketBits = 3;
+  static const int kMaxExponent = 40;
+  static const int kBuckets = (kMaxExponent - kSubBucketBits + 1)
+                              << kSubBucketBits;
+  // count, sum and max followed by the buckets
+  static const int kHistogramSlots = 3 + kBuckets;
+  static const int kChunkSlots = 4096;
+  static const int kMaxChunks = 64;
+
+  struct Descriptor {
+    std::string name;
+    Kind kind;
+    int slot;
+  };
+
+  struct Shard {
+    int id;
+    std::string name;
+    std::atomic<std::atomic<int64_t>*> chunks[kMaxChunks];
+  };
+
+  // Values of every metric slot for the totals or for a single thread.
+  struct Values {
+    int id;
+    std::string name;
+    std::vector<int64_t> slots;
+  };
+
+  // Retires the thread's shard when the thread exits.
+  struct ShardOwner {
+    Shard* shard = nullptr;
+    ~ShardOwner() {
+      if (shard != nullptr) Retire(shard);
+    }
+  };
+
+  // Returns the id of the metric, registering it on first use, or -1 when
+  // the name is taken by a metric of another kind or the registry is full.
+  static int Register(const std::string& name, Kind kind);
+  static int Count() { return count_.load(std::memory_order_acquire); }
+  static const Descriptor& Get(int id) { return descriptors_[id]; }
+
+  static void Add(int id, int64_t delta);
+  static void Set(int id, int64_t value);
+  static void Record(int id, int64_t value);
+  static void SetThreadName(const std::string& name);
+
+  // Fills totals and, with per_thread, one entry per live thread. Counters
+  // and histograms are zeroed while reading when reset is set.
+  static void Collect(Values* totals, std::vector<Values>* threads,
+                      bool per_thread, bool reset);
+
+  static int Bucket(uint64_t value);
+  static uint64_t BucketLow(int bucket);
+  static uint64_t BucketHigh(int bucket);
+  static double Quantile(const int64_t* histogram, double q);
+
+ private:
+  static Shard* NewShard();
+  static Shard* CurrentShard();
+  static std::atomic<int64_t>* Slot(Shard* shard, int slot);
+  static void Retire(Shard* shard);
+  static void Merge(const Shard* shard, std::vector<int64_t>* slots,
+                    bool reset, bool gauges);
+
+  static base::LazyMutex mutex_;
+  static Descriptor descriptors_[kMaxMetrics];
+  static std::atomic<int> count_;
+  static int next_slot_;
+  static int next_shard_id_;
+  static std::vector<Shard*> shards_;
+  // counters and histograms of the threads that have exited
+  static Shard* retired_;
+  static thread_local ShardOwner owner_;
+};
+
+base::LazyMutex Metrics::mutex_;
+Metrics::Descriptor Metrics::descriptors_[Metrics::kMaxMetrics];
+std::atomic<int> Metrics::count_(0);
+int Metrics::next_slot_ = 0;
+int Metrics::next_shard_id_ = 0;
+std::vector<Metrics::Shard*> Metrics::shards_;
+Metrics::Shard* Metrics::retired_ = nullptr;
+thread_local Metrics::ShardOwner Metrics::owner_;
+
+int Metrics::Register(const std::string& name, Kind kind) {
+  base::MutexGuard lock_guard(mutex_.Pointer());
+  int count = count_.load(std::memory_order_relaxed);
+  for (int i = 0; i < count; i++) {
+    if (descriptors_[i].name == name) {
+      return descriptors_[i].kind == kind ? i : -1;
+    }
+  }
+  int size = kind == kHistogram ? kHistogramSlots : 1;
+  int slot = next_slot_;
+  // a metric never straddles two chunks
+  if (slot % kChunkSlots + size > kChunkSlots) {
+    slot += kChunkSlots - slot % kChunkSlots;
+  }
+  if (count == kMaxMetrics || slot + size > kChunkSlots * kMaxChunks) {
+    return -1;
+  }
+  descriptors_[count].name = name;
+  descriptors_[count].kind = kind;
+  descriptors_[count].slot = slot;
+  next_slot_ = slot + size;
+  count_.store(count + 1, std::memory_order_release);
+  return count;
+}
+
+Metrics::Shard* Metrics::NewShard() {
+  Shard* shard = new Shard();
+  for (int i = 0; i < kMaxChunks; i++) {
+    shard->chunks[i].store(nullptr, std::memory_order_relaxed);
+  }
+  shard->id = next_shard_id_++;
+  shard->name = "thread";
+  return shard;
+}
+
+Metrics::Shard* Metrics::CurrentShard() {
+  if (owner_.shard == nullptr) {
+    base::MutexGuard lock_guard(mutex_.Pointer());
+    owner_.shard = NewShard();
+    shards_.push_back(owner_.shard);
+  }
+  return owner_.shard;
+}
+
+std::atomic<int64_t>* Metrics::Slot(Shard* shard, int slot) {
+  std::atomic<int64_t>* chunk =
+      shard->chunks[slot / kChunkSlots].load(std::memory_order_acquire);
+  if (chunk == nullptr) {
+    // only the owning thread (or Retire() under the lock) allocates
+    chunk = new std::atomic<int64_t>[kChunkSlots];
+    for (int i = 0; i < kChunkSlots; i++) {
+      chunk[i].store(0, std::memory_order_relaxed);
+    }
+    shard->chunks[slot / kChunkSlots].store(chunk, std::memory_order_release);
+  }
+  return &chunk[slot % kChunkSlots];
+}
+
+void Metrics::Add(int id, int64_t delta) {
+  if (id < 0 || id >= Count()) return;
+  Slot(CurrentShard(), descriptors_[id].slot)
+      ->fetch_add(delta, std::memory_order_relaxed);
+}
+
+void Metrics::Set(int id, int64_t value) {
+  if (id < 0 || id >= Count()) return;
+  Slot(CurrentShard(), descriptors_[id].slot)
+      ->store(value, std::memory_order_relaxed);
+}
+
+void Metrics::Record(int id, int64_t value) {
+  if (id < 0 || id >= Count() || descriptors_[id].kind != kHistogram) return;
+  if (value < 0) value = 0;
+  std::atomic<int64_t>* h = Slot(CurrentShard(), descriptors_[id].slot);
+  h[0].fetch_add(1, std::memory_order_relaxed);
+  h[1].fetch_add(value, std::memory_order_relaxed);
+  int64_t max = h[2].load(std::memory_order_relaxed);
+  while (value > max &&
+         !h[2].compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+  h[3 + Bucket(static_cast<uint64_t>(value))].fetch_add(
+      1, std::memory_order_relaxed);
+}
+
+void Metrics::SetThreadName(const std::string& name) {
+  Shard* shard = CurrentShard();
+  base::MutexGuard lock_guard(mutex_.Pointer());
+  shard->name = name;
+}
+
+void Metrics::Merge(const Shard* shard, std::vector<int64_t>* slots,
+                    bool reset, bool gauges) {
+  int count = Count();
+  for (int i = 0; i < count; i++) {
+    const Descriptor& d = descriptors_[i];
+    if (d.kind == kGauge && !gauges) continue;
+    std::atomic<int64_t>* chunk =
+        shard->chunks[d.slot / kChunkSlots].load(std::memory_order_acquire);
+    if (chunk == nullptr) continue;
+    std::atomic<int64_t>* values = &chunk[d.slot % kChunkSlots];
+    int size = d.kind == kHistogram ? kHistogramSlots : 1;
+    bool zero = reset && d.kind != kGauge;
+    for (int j = 0; j < size; j++) {
+      int64_t v = zero ? values[j].exchange(0, std::memory_order_relaxed)
+                       : values[j].load(std::memory_order_relaxed);
+      int64_t& out = (*slots)[d.slot + j];
+      if (d.kind == kHistogram && j == 2) {
+        out = std::max(out, v);
+      } else {
+        out += v;
+      }
+    }
+  }
+}
+
+void Metrics::Retire(Shard* shard) {
+  base::MutexGuard lock_guard(mutex_.Pointer());
+  shards_.erase(std::remove(shards_.begin(), shards_.end(), shard),
+                shards_.end());
+  if (retired_ == nullptr) {
+    retired_ = NewShard();
+    retired_->name = "retired";
+  }
+  // gauges describe live state and go away with the thread
+  std::vector<int64_t> slots(next_slot_, 0);
+  Merge(shard, &slots, false, false);
+  int count = Count();
+  for (int i = 0; i < count; i++) {
+    const Descriptor& d = descriptors_[i];
+    if (d.kind == kGauge) continue;
+    int size = d.kind == kHistogram ? kHistogramSlots : 1;
+    std::atomic<int64_t>* values = Slot(retired_, d.slot);
+    for (int j = 0; j < size; j++) {
+      int64_t v = slots[d.slot + j];
+      if (d.kind == kHistogram && j == 2) {
+        if (v > values[j].load(std::memory_order_relaxed)) {
+          values[j].store(v, std::memory_order_relaxed);
+        }
+      } else {
+        values[j].fetch_add(v, std::memory_order_relaxed);
+      }
+    }
+  }
+  for (int i = 0; i < kMaxChunks; i++) {
+    delete[] shard->chunks[i].load(std::memory_order_relaxed);
+  }
+  delete shard;
+}
+
+void Metrics::Collect(Values* totals, std::vector<Values>* threads,
+                      bool per_thread, bool reset) {
+  base::MutexGuard lock_guard(mutex_.Pointer());
+  totals->id = -1;
+  totals->name = "total";
+  totals->slots.assign(next_slot_, 0);
+  for (Shard* shard : shards_) {
+    if (per_thread) {
+      Values values;
+      values.id = shard->id;
+      values.name = shard->name;
+      values.slots.assign(next_slot_, 0);
+      Merge(shard, &values.slots, false, true);
+      threads->push_back(std::move(values));
+    }
+    Merge(shard, &totals->slots, reset, true);
+  }
+  if (retired_ != nullptr) Merge(retired_, &totals->slots, reset, false);
+}
+
+int Metrics::Bucket(uint64_t value) {
+  if (value < (1u << kSubBucketBits)) return static_cast<int>(value);
+  int exponent = 63 - base::bits::CountLeadingZeros64(value);
+  if (exponent >= kMaxExponent) return kBuckets - 1;
+  return ((exponent - kSubBucketBits + 1) << kSubBucketBits) +
+         static_cast<int>((value >> (exponent - kSubBucketBits)) &
+                          ((1u << kSubBucketBits) - 1));
+}
+
+uint64_t Metrics::BucketLow(int bucket) {
+  if (bucket < (1 << kSubBucketBits)) return bucket;
+  int exponent = (bucket >> kSubBucketBits) + kSubBucketBits - 1;
+  uint64_t mantissa = (1u << kSubBucketBits) +
+                      (bucket & ((1u << kSubBucketBits) - 1));
+  return mantissa << (exponent - kSubBucketBits);
+}
+
+uint64_t Metrics::BucketHigh(int bucket) {
+  if (bucket < (1 << kSubBucketBits)) return bucket;
+  int exponent = (bucket >> kSubBucketBits) + kSubBucketBits - 1;
+  return BucketLow(bucket) + (uint64_t(1) << (exponent - kSubBucketBits)) - 1;
+}
+
+// histogram points at the count, sum, max and buckets slots; the estimate is
+// the middle of the bucket holding the requested rank, capped at the max
+double Metrics::Quantile(const int64_t* histogram, double q) {
+  int64_t count = histogram[0];
+  if (count <= 0) return 0;
+  int64_t rank = static_cast<int64_t>(std::ceil(q * count));
+  if (rank < 1) rank = 1;
+  int64_t seen = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    seen += histogram[3 + i];
+    if (seen >= rank) {
+      double mid = (BucketLow(i) + BucketHigh(i)) / 2.0;
+      return std::min(mid, static_cast<double>(histogram[2]));
+    }
+  }
+  return static_cast<double>(histogram[2]);
+}
+
+static void SetNumber(Isolate* isolate, Local<Context> context,
+                      Local<Object> object, const char* name, double value) {
+  object
+      ->Set(context, String::NewFromUtf8(isolate, name).ToLocalChecked(),
+            Number::New(isolate, value))
+      .FromJust();
+}
+
+// {counters: {...}, gauges: {...}, histograms: {name: {count, sum, ...}}}
+static Local<Object> MetricsValuesToObject(Isolate* isolate,
+                                           Local<Context> context,
+                                           const Metrics::Values& values) {
+  Local<Object> result = Object::New(isolate);
+  Local<Object> counters = Object::New(isolate);
+  Local<Object> gauges = Object::New(isolate);
+  Local<Object> histograms = Object::New(isolate);
+  int count = Metrics::Count();
+  for (int i = 0; i < count; i++) {
+    const Metrics::Descriptor& d = Metrics::Get(i);
+    const int64_t* v = values.slots.data() + d.slot;
+    if (d.kind == Metrics::kCounter) {
+      SetNumber(isolate, context, counters, d.name.c_str(), v[0]);
+    } else if (d.kind == Metrics::kGauge) {
+      SetNumber(isolate, context, gauges, d.name.c_str(), v[0]);
+    } else {
+      Local<Object> h = Object::New(isolate);
+      SetNumber(isolate, context, h, "count", v[0]);
+      SetNumber(isolate, context, h, "sum", v[1]);
+      SetNumber(isolate, context, h, "mean",
+                v[0] > 0 ? static_cast<double>(v[1]) / v[0] : 0);
+      SetNumber(isolate, context, h, "max", v[2]);
+      SetNumber(isolate, context, h, "p50", Metrics::Quantile(v, 0.5));
+      SetNumber(isolate, context, h, "p90", Metrics::Quantile(v, 0.9));
+      SetNumber(isolate, context, h, "p99", Metrics::Quantile(v, 0.99));
+      SetNumber(isolate, context, h, "p999", Metrics::Quantile(v, 0.999));
+      histograms
+          ->Set(context,
+                String::NewFromUtf8(isolate, d.name.c_str()).ToLocalChecked(),
+                h)
+          .FromJust();
+    }
+  }
+  result
+      ->Set(context, String::NewFromUtf8(isolate, "counters").ToLocalChecked(),
+            counters)
+      .FromJust();
+  result
+      ->Set(context, String::NewFromUtf8(isolate, "gauges").ToLocalChecked(),
+            gauges)
+      .FromJust();
+  result
+      ->Set(context,
+            String::NewFromUtf8(isolate, "histograms").ToLocalChecked(),
+            histograms)
+      .FromJust();
+  return result;
+}
+
+static bool GetBooleanOption(Isolate* isolate, Local<Context> context,
+                             Local<Value> options, const char* name) {
+  if (!options->IsObject()) return false;
+  Local<Value> value;
+  if (!options.As<Object>()
+           ->Get(context, String::NewFromUtf8(isolate, name).ToLocalChecked())
+           .ToLocal(&value)) {
+    return false;
+  }
+  return value->BooleanValue(isolate);
+}
+
+static Local<Object> MetricsSnapshot(Isolate* isolate, Local<Context> context,
+                                     bool workers, bool reset) {
+  Metrics::Values totals;
+  std::vector<Metrics::Values> threads;
+  Metrics::Collect(&totals, &threads, workers, reset);
+  Local<Object> result = MetricsValuesToObject(isolate, context, totals);
+  SetNumber(isolate, context, result, "time",
+            base::OS::TimeCurrentMillis());
+  if (workers) {
+    Local<Array> list = Array::New(isolate, static_cast<int>(threads.size()));
+    for (size_t i = 0; i < threads.size(); i++) {
+      Local<Object> entry =
+          MetricsValuesToObject(isolate, context, threads[i]);
+      SetNumber(isolate, context, entry, "id", threads[i].id);
+      entry
+          ->Set(context, String::NewFromUtf8(isolate, "name").ToLocalChecked(),
+                String::NewFromUtf8(isolate, threads[i].name.c_str())
+                    .ToLocalChecked())
+          .FromJust();
+      list->Set(context, static_cast<uint32_t>(i), entry).FromJust();
+    }
+    result
+        ->Set(context, String::NewFromUtf8(isolate, "workers").ToLocalChecked(),
+              list)
+        .FromJust();
+  }
+  return result;
+}
+
+static std::string PrometheusName(const std::string& name) {
+  std::string result = "tinn_";
+  for (char c : name) {
+    result += (isalnum(static_cast<unsigned char>(c)) || c == '_') ? c : '_';
+  }
+  return result;
+}
+
+// Prometheus text exposition format, totals only.
+static std::string MetricsPrometheus() {
+  Metrics::Values totals;
+  std::vector<Metrics::Values> threads;
+  Metrics::Collect(&totals, &threads, false, false);
+  std::ostringstream out;
+  int count = Metrics::Count();
+  for (int i = 0; i < count; i++) {
+    const Metrics::Descriptor& d = Metrics::Get(i);
+    const int64_t* v = totals.slots.data() + d.slot;
+    std::string name = PrometheusName(d.name);
+    if (d.kind != Metrics::kHistogram) {
+      out << "# TYPE " << name
+          << (d.kind == Metrics::kCounter ? " counter\n" : " gauge\n");
+      out << name << " " << v[0] << "\n";
+      continue;
+    }
+    out << "# TYPE " << name << " histogram\n";
+    int64_t cumulative = 0;
+    for (int b = 0; b < Metrics::kBuckets; b++) {
+      if (v[3 + b] == 0) continue;
+      cumulative += v[3 + b];
+      out << name << "_bucket{le=\"" << Metrics::BucketHigh(b) << "\"} "
+          << cumulative << "\n";
+    }
+    out << name << "_bucket{le=\"+Inf\"} " << v[0] << "\n";
+    out << name << "_sum " << v[1] << "\n";
+    out << name << "_count " << v[0] << "\n";
+  }
+  return out.str();
+}
+
+static void MetricsIncrement(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  int id = args.Data().As<Integer>()->Value();
+  int64_t delta = 1;
+  if (args.Length() > 0) {
+    delta = args[0]->IntegerValue(isolate->GetCurrentContext()).FromMaybe(0);
+  }
+  Metrics::Add(id, delta);
+}
+
+static void MetricsDecrement(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  int id = args.Data().As<Integer>()->Value();
+  int64_t delta = 1;
+  if (args.Length() > 0) {
+    delta = args[0]->IntegerValue(isolate->GetCurrentContext()).FromMaybe(0);
+  }
+  Metrics::Add(id, -delta);
+}
+
+static void MetricsSet(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (args.Length() == 0 || !args[0]->IsNumber()) {
+    Throw(isolate, "invalid arguments");
+    return;
+  }
+  Metrics::Set(args.Data().As<Integer>()->Value(),
+               args[0]->IntegerValue(isolate->GetCurrentContext()).FromJust());
+}
+
+static void MetricsRecord(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (args.Length() == 0 || !args[0]->IsNumber()) {
+    Throw(isolate, "invalid arguments");
+    return;
+  }
+  double value = args[0]->NumberValue(isolate->GetCurrentContext()).FromJust();
+  Metrics::Record(args.Data().As<Integer>()->Value(),
+                  static_cast<int64_t>(value + 0.5));
+}
+
+// histogram.time(fn): runs fn and records how long it took in microseconds
+static void MetricsTime(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (args.Length() == 0 || !args[0]->IsFunction()) {
+    Throw(isolate, "invalid arguments");
+    return;
+  }
+  base::TimeTicks start = base::TimeTicks::HighResolutionNow();
+  MaybeLocal<Value> result =
+      args[0].As<Function>()->Call(isolate->GetCurrentContext(),
+                                   Undefined(isolate), 0, nullptr);
+  Metrics::Record(args.Data().As<Integer>()->Value(),
+                  (base::TimeTicks::HighResolutionNow() - start)
+                      .InMicroseconds());
+  Local<Value> value;
+  if (result.ToLocal(&value)) args.GetReturnValue().Set(value);
+}
+
+static void AddMetricMethod(Isolate* isolate, Local<Context> context,
+                            Local<Object> handle, const char* name,
+                            FunctionCallback callback, int id) {
+  handle
+      ->Set(context, String::NewFromUtf8(isolate, name).ToLocalChecked(),
+            Function::New(context, callback, Integer::New(isolate, id))
+                .ToLocalChecked())
+      .FromJust();
+}
+
+// Metrics.counter/gauge/histogram(name) return a handle bound to the metric
+// id, so recording through it skips the name lookup.
+static void MetricsHandle(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  if (args.Length() == 0 || !args[0]->IsString()) {
+    Throw(isolate, "invalid arguments");
+    return;
+  }
+  Metrics::Kind kind =
+      static_cast<Metrics::Kind>(args.Data().As<Integer>()->Value());
+  v8::String::Utf8Value name(isolate, args[0]);
+  int id = Metrics::Register(std::string(*name, name.length()), kind);
+  if (id < 0) {
+    Throw(isolate,
+          "Metrics: name already used by another kind of metric or too many "
+          "metrics");
+    return;
+  }
+  Local<Object> handle = Object::New(isolate);
+  handle
+      ->Set(context, String::NewFromUtf8(isolate, "name").ToLocalChecked(),
+            args[0])
+      .FromJust();
+  if (kind == Metrics::kHistogram) {
+    AddMetricMethod(isolate, context, handle, "record", MetricsRecord, id);
+    AddMetricMethod(isolate, context, handle, "time", MetricsTime, id);
+  } else {
+    AddMetricMethod(isolate, context, handle, "inc", MetricsIncrement, id);
+    if (kind == Metrics::kGauge) {
+      AddMetricMethod(isolate, context, handle, "dec", MetricsDecrement, id);
+      AddMetricMethod(isolate, context, handle, "set", MetricsSet, id);
+    }
+  }
+  args.GetReturnValue().Set(handle);
+}
+
+static void MetricsGetSnapshot(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  Local<Value> options =
+      args.Length() > 0 ? args[0] : Undefined(isolate).As<Value>();
+  args.GetReturnValue().Set(MetricsSnapshot(
+      isolate, context, GetBooleanOption(isolate, context, options, "workers"),
+      GetBooleanOption(isolate, context, options, "reset")));
+}
+
+// Metrics.export([format]): 'json' (default, totals and workers) or
+// 'prometheus'
+static void MetricsExport(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  Local<Context> context = isolate->GetCurrentContext();
+  std::string format = "json";
+  if (args.Length() > 0 && args[0]->IsString()) {
+    v8::String::Utf8Value jsFormat(isolate, args[0]);
+    format = *jsFormat;
+  }
+  if (format == "prometheus") {
+    args.GetReturnValue().Set(
+        String::NewFromUtf8(isolate, MetricsPrometheus().c_str())
+            .ToLocalChecked());
+  } else if (format == "json") {
+    Local<Object> snapshot = MetricsSnapshot(isolate, context, true, false);
+    Local<String> json;
+    if (JSON::Stringify(context, snapshot).ToLocal(&json)) {
+      args.GetReturnValue().Set(json);
+    }
+  } else {
+    Throw(isolate, "Metrics.export: unknown format");
+  }
+}
+
+static void MetricsReset(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Metrics::Values totals;
+  std::vector<Metrics::Values> threads;
+  Metrics::Collect(&totals, &threads, false, true);
+}
+
+static void MetricsSetThreadName(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  if (args.Length() == 0 || !args[0]->IsString()) {
+    Throw(isolate, "invalid arguments");
+    return;
+  }
+  v8::String::Utf8Value name(isolate, args[0]);
+  Metrics::SetThreadName(std::string(*name, name.length()));
+}
+
+// microseconds from a monotonic clock, for timing with histogram.record()
+static void MetricsNow(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  args.GetReturnValue().Set(
+      (base::TimeTicks::HighResolutionNow() - base::TimeTicks()).InMicroseconds() *
+      1.0);
+}
+
+void Shell::AddTINNMetrics(Isolate* isolate, v8::Local<v8::Context> &context) {
+  v8::HandleScope handle_scope(isolate);
+  Context::Scope scope(context);
+
+  Local<ObjectTemplate> metrics = ObjectTemplate::New(isolate);
+  metrics->Set(String::NewFromUtf8(isolate, "counter").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsHandle,
+                                     Integer::New(isolate, Metrics::kCounter)));
+  metrics->Set(String::NewFromUtf8(isolate, "gauge").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsHandle,
+                                     Integer::New(isolate, Metrics::kGauge)));
+  metrics->Set(
+      String::NewFromUtf8(isolate, "histogram").ToLocalChecked(),
+      FunctionTemplate::New(isolate, MetricsHandle,
+                            Integer::New(isolate, Metrics::kHistogram)));
+  metrics->Set(String::NewFromUtf8(isolate, "snapshot").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsGetSnapshot));
+  metrics->Set(String::NewFromUtf8(isolate, "export").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsExport));
+  metrics->Set(String::NewFromUtf8(isolate, "reset").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsReset));
+  metrics->Set(String::NewFromUtf8(isolate, "setThreadName").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsSetThreadName));
+  metrics->Set(String::NewFromUtf8(isolate, "now").ToLocalChecked(),
+               FunctionTemplate::New(isolate, MetricsNow));
+
+  Local<Object> instance = metrics->NewInstance(context).ToLocalChecked();
+  context->Global()
+      ->Set(context, String::NewFromUtf8(isolate, "Metrics").ToLocalChecked(),
+            instance)
+      .FromJust();
+}
+
 #ifndef _WIN32 
 extern char **environ;
 #endif
@@ -2973,6 +4525,14 @@ void Shell::AddTINNOS(Isolate* isolate, v8::Local<v8::Context> &context) {
 	os->Set(v8::String::NewFromUtf8(isolate, "writeString").ToLocalChecked(), FunctionTemplate::New(isolate, OSWriteString));
 	os->Set(v8::String::NewFromUtf8(isolate, "readString").ToLocalChecked(), FunctionTemplate::New(isolate, OSReadString));
 	os->Set(v8::String::NewFromUtf8(isolate, "writeBytes").ToLocalChecked(), FunctionTemplate::New(isolate, OSWritebytes));
+	os->Set(v8::String::NewFromUtf8(isolate, "readBuffer").ToLocalChecked(), FunctionTemplate::New(isolate, OSReadBuffer));
+	os->Set(v8::String::NewFromUtf8(isolate, "readInto").ToLocalChecked(), FunctionTemplate::New(isolate, OSReadInto));
+	os->Set(v8::String::NewFromUtf8(isolate, "writeBuffer").ToLocalChecked(), FunctionTemplate::New(isolate, OSWriteBuffer));
+	os->Set(v8::String::NewFromUtf8(isolate, "pread").ToLocalChecked(), FunctionTemplate::New(isolate, OSPread));
+	os->Set(v8::String::NewFromUtf8(isolate, "pwrite").ToLocalChecked(), FunctionTemplate::New(isolate, OSPwrite));
+	os->Set(v8::String::NewFromUtf8(isolate, "readFileBuffer").ToLocalChecked(), FunctionTemplate::New(isolate, OSReadFileBuffer));
+	os->Set(v8::String::NewFromUtf8(isolate, "mmap").ToLocalChecked(), FunctionTemplate::New(isolate, OSMmap));
+	os->Set(v8::String::NewFromUtf8(isolate, "munmap").ToLocalChecked(), FunctionTemplate::New(isolate, OSMunmap));
 
 	
 	os->SetInternalFieldCount(1);  
@@ -3149,6 +4709,11 @@ Local<ObjectTemplate> Shell::CreateGlobalTemplate(Isolate* isolate) {
           .ToLocalChecked(),
       FunctionTemplate::New(isolate, WorkerGetMessage, Local<Value>(),
                             worker_signature));
+  worker_fun_template->PrototypeTemplate()->Set(
+      String::NewFromUtf8(isolate, "getMessages", NewStringType::kNormal)
+          .ToLocalChecked(),
+      FunctionTemplate::New(isolate, WorkerGetMessages, Local<Value>(),
+                            worker_signature));
   worker_fun_template->InstanceTemplate()->SetInternalFieldCount(1);
   global_template->Set(
       String::NewFromUtf8(isolate, "Worker", NewStringType::kNormal)
@@ -3358,6 +4923,7 @@ Local<Context> Shell::CreateEvaluationContext(Isolate* isolate) {
   }
 
    AddTINNOS(isolate, context);  
+   AddTINNMetrics(isolate, context);
    //attach modules
   for (auto it : gModules)
   {
@@ -3986,36 +5552,92 @@ ExternalizedContents::~ExternalizedContents() {
   }
 }
 
+SerializationDataQueue::SerializationDataQueue()
+    : size_(0), waiting_(false), semaphore_(0) {
+  tail_ = new Node();
+  tail_->next.store(nullptr, std::memory_order_relaxed);
+  head_.store(tail_, std::memory_order_relaxed);
+}
+
+SerializationDataQueue::~SerializationDataQueue() {
+  Clear();
+  delete tail_;
+}
+
 void SerializationDataQueue::Enqueue(std::unique_ptr<SerializationData> data) {
-  base::MutexGuard lock_guard(&mutex_);
-  data_.push_back(std::move(data));
+  Node* node = new Node();
+  node->next.store(nullptr, std::memory_order_relaxed);
+  node->data = std::move(data);
+  Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+  size_.fetch_add(1, std::memory_order_relaxed);
+  // Pairs with the fence in DequeueWait(): either the consumer sees the new
+  // node on its re-check or we see that it is about to sleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed) &&
+      waiting_.exchange(false, std::memory_order_acq_rel)) {
+    semaphore_.Signal();
+  }
 }
 
 bool SerializationDataQueue::Dequeue(
     std::unique_ptr<SerializationData>* out_data) {
   out_data->reset();
-  base::MutexGuard lock_guard(&mutex_);
-  if (data_.empty()) return false;
-  *out_data = std::move(data_[0]);
-  data_.erase(data_.begin());
+  Node* tail = tail_;
+  Node* next = tail->next.load(std::memory_order_acquire);
+  if (next == nullptr) return false;
+  *out_data = std::move(next->data);
+  tail_ = next;
+  delete tail;
+  size_.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool SerializationDataQueue::DequeueWait(
+    std::unique_ptr<SerializationData>* out_data, double timeout_ms) {
+  base::TimeTicks deadline;
+  if (timeout_ms > 0) {
+    deadline = base::TimeTicks::Now() +
+               base::TimeDelta::FromMicroseconds(
+                   static_cast<int64_t>(timeout_ms * 1000));
+  }
+  while (!Dequeue(out_data)) {
+    if (timeout_ms == 0) return false;
+    waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (Dequeue(out_data)) {
+      // A producer may still signal; the extra count only causes one
+      // spurious wakeup later, which the loop absorbs.
+      waiting_.store(false, std::memory_order_relaxed);
+      return true;
+    }
+    if (timeout_ms < 0) {
+      semaphore_.Wait();
+    } else {
+      base::TimeDelta remaining = deadline - base::TimeTicks::Now();
+      if (remaining <= base::TimeDelta() || !semaphore_.WaitFor(remaining)) {
+        waiting_.store(false, std::memory_order_relaxed);
+        return Dequeue(out_data);
+      }
+    }
+  }
   return true;
 }
 
 bool SerializationDataQueue::IsEmpty() {
-  base::MutexGuard lock_guard(&mutex_);
-  return data_.empty();
+  return tail_->next.load(std::memory_order_acquire) == nullptr;
 }
 
 void SerializationDataQueue::Clear() {
-  base::MutexGuard lock_guard(&mutex_);
-  data_.clear();
+  std::unique_ptr<SerializationData> data;
+  while (Dequeue(&data)) {
+  }
 }
 
-Worker::Worker(const char* script)
-    : in_semaphore_(0),
-      out_semaphore_(0),
-      thread_(nullptr),
+Worker::Worker(const char* script, int batch_size)
+    : thread_(nullptr),
       script_(i::StrDup(script)),
+      batch_size_(batch_size),
       running_(false) {}
 
 Worker::~Worker() {
@@ -4050,20 +5672,36 @@ void Worker::WorkerThread::Run() {
 
 void Worker::PostMessage(std::unique_ptr<SerializationData> data) {
   in_queue_.Enqueue(std::move(data));
-  in_semaphore_.Signal();
 }
 
-std::unique_ptr<SerializationData> Worker::GetMessage() {
+std::unique_ptr<SerializationData> Worker::GetMessage(double timeout_ms) {
   std::unique_ptr<SerializationData> result;
-  while (!out_queue_.Dequeue(&result)) {
+  if (!out_queue_.Dequeue(&result)) {
     // If the worker is no longer running, and there are no messages in the
     // queue, don't expect any more messages from it.
-    if (!base::Relaxed_Load(&running_)) break;
-    out_semaphore_.Wait();
+    if (!base::Relaxed_Load(&running_)) return result;
+    if (!out_queue_.DequeueWait(&result, timeout_ms)) return result;
   }
+  // nullptr is posted by the worker thread once it has exited.
+  if (!result) base::Relaxed_Store(&running_, false);
   return result;
 }
 
+void Worker::GetMessages(
+    size_t max, double timeout_ms,
+    std::vector<std::unique_ptr<SerializationData>>* out) {
+  std::unique_ptr<SerializationData> data = GetMessage(timeout_ms);
+  if (!data) return;
+  out->push_back(std::move(data));
+  while (out->size() < max && out_queue_.Dequeue(&data)) {
+    if (!data) {
+      base::Relaxed_Store(&running_, false);
+      break;
+    }
+    out->push_back(std::move(data));
+  }
+}
+
 void Worker::Terminate() {
   base::Relaxed_Store(&running_, false);
   // Post nullptr to wake the Worker thread message loop, and tell it to stop
@@ -4077,6 +5715,7 @@ void Worker::WaitForThread() {
 }
 
 void Worker::ExecuteInThread() {
+  Metrics::SetThreadName("worker");
   Isolate::CreateParams create_params;
   create_params.array_buffer_allocator = Shell::array_buffer_allocator;
   Isolate* isolate = Isolate::New(create_params);
@@ -4139,17 +5778,42 @@ void Worker::ExecuteInThread() {
             SealHandleScope shs(isolate);
             // Now wait for messages
             while (true) {
-              in_semaphore_.Wait();
               std::unique_ptr<SerializationData> data;
-              if (!in_queue_.Dequeue(&data)) continue;
+              in_queue_.DequeueWait(&data, -1);
               if (!data) {
                 break;
               }
               v8::TryCatch try_catch(isolate);
               HandleScope scope(isolate);
               Local<Value> value;
-              if (Shell::DeserializeValue(isolate, std::move(data))
-                      .ToLocal(&value)) {
+              bool terminated = false;
+              if (batch_size_ > 0) {
+                // Hand everything already queued (up to batch_size_) to a
+                // single onmessage call.
+                Local<Array> batch = Array::New(isolate);
+                uint32_t count = 0;
+                while (true) {
+                  if (Shell::DeserializeValue(isolate, std::move(data))
+                          .ToLocal(&value)) {
+                    batch->Set(context, count++, value).FromJust();
+                  }
+                  if (count >= static_cast<uint32_t>(batch_size_) ||
+                      !in_queue_.Dequeue(&data)) {
+                    break;
+                  }
+                  if (!data) {
+                    terminated = true;
+                    break;
+                  }
+                }
+                if (count > 0) {
+                  Local<Value> argv[] = {batch};
+                  MaybeLocal<Value> result =
+                      onmessage_fun->Call(context, global, 1, argv);
+                  USE(result);
+                }
+              } else if (Shell::DeserializeValue(isolate, std::move(data))
+                             .ToLocal(&value)) {
                 Local<Value> argv[] = {value};
                 MaybeLocal<Value> result =
                     onmessage_fun->Call(context, global, 1, argv);
@@ -4158,6 +5822,7 @@ void Worker::ExecuteInThread() {
               if (try_catch.HasCaught()) {
                 Shell::ReportException(isolate, &try_catch);
               }
+              if (terminated) break;
             }
           }
         }
@@ -4170,7 +5835,6 @@ void Worker::ExecuteInThread() {
 
   // Post nullptr to wake the thread waiting on GetMessage() if there is one.
   out_queue_.Enqueue(nullptr);
-  out_semaphore_.Signal();
 }
 
 void Worker::PostMessageOut(const v8::FunctionCallbackInfo<v8::Value>& args) {
@@ -4183,7 +5847,8 @@ void Worker::PostMessageOut(const v8::FunctionCallbackInfo<v8::Value>& args) {
   }
 
   Local<Value> message = args[0];
-  Local<Value> transfer = Undefined(isolate);
+  Local<Value> transfer =
+      args.Length() >= 2 ? args[1] : Local<Value>::Cast(Undefined(isolate));
   std::unique_ptr<SerializationData> data =
       Shell::SerializeValue(isolate, message, transfer);
   if (data) {
@@ -4191,7 +5856,6 @@ void Worker::PostMessageOut(const v8::FunctionCallbackInfo<v8::Value>& args) {
     Local<External> this_value = Local<External>::Cast(args.Data());
     Worker* worker = static_cast<Worker*>(this_value->Value());
     worker->out_queue_.Enqueue(std::move(data));
-    worker->out_semaphore_.Signal();
   }
 }
 
@@ -4311,6 +5975,12 @@ bool Shell::SetOptions(int argc, char* argv[]) {
         return false;
       }
       argv[i] = nullptr;
+    } else if (strncmp(argv[i], "--code-cache-dir=", 17) == 0) {
+      options.code_cache_dir = argv[i] + 17;
+      argv[i] = nullptr;
+    } else if (strcmp(argv[i], "--no-code-cache") == 0) {
+      options.use_code_cache = false;
+      argv[i] = nullptr;
     } else if (strcmp(argv[i], "--enable-tracing") == 0) {
       options.trace_enabled = true;
       argv[i] = nullptr;
@@ -4378,6 +6048,17 @@ bool Shell::SetOptions(int argc, char* argv[]) {
   }
   current->End(argc);
 
+  if (options.code_cache_dir == nullptr) {
+    options.code_cache_dir = getenv("TINN_CODE_CACHE_DIR");
+  }
+  if (options.code_cache_dir != nullptr) {
+#ifdef _WIN32
+    mkdir(options.code_cache_dir);
+#else
+    mkdir(options.code_cache_dir, 0777);
+#endif
+  }
+
   if (!logfile_per_isolate && options.num_isolates) {
     V8::SetFlagsFromString("--no-logfile-per-isolate");
   }
@@ -4665,6 +6346,11 @@ class Serializer : public ValueSerializer::Delegate {
 
           Local<ArrayBuffer> array_buffer = Local<ArrayBuffer>::Cast(element);
 
+          if (IsMappedBuffer(array_buffer->GetContents().Data())) {
+            Throw(isolate_, "ArrayBuffer from os.mmap can't be transferred");
+            return Nothing<bool>();
+          }
+
           if (std::find(array_buffers_.begin(), array_buffers_.end(),
                         array_buffer) != array_buffers_.end()) {
             Throw(isolate_,
@@ -4845,6 +6531,7 @@ int Shell::Main(int argc, char* argv[]) {
   setupConsole();
 #endif  
   if (!SetOptions(argc, argv)) return 1;
+  Metrics::SetThreadName("main");
 
   v8::V8::InitializeICUDefaultLocation(argv[0], options.icu_data_file);
 
@@ -5086,6 +6773,47 @@ int Shell::Main(int argc, char* argv[]) {
 
 }  // namespace v8
 
+#if defined(_WIN32)
+#define TINN_EXPORT __declspec(dllexport)
+#else
+#define TINN_EXPORT __attribute__((visibility("default")))
+#endif
+
+// Lets native modules compile through the shared code cache; tinn is linked
+// with -rdynamic so they can look this up with dlsym (see mod_javascript).
+extern "C" TINN_EXPORT bool tinn_CompileScript(
+    v8::Isolate* isolate, v8::Local<v8::String>* source,
+    v8::Local<v8::Value>* name, const char* path,
+    v8::Local<v8::Script>* script) {
+  v8::ScriptOrigin origin(*name);
+  std::string cache_key;
+  return v8::Shell::CompileWithCodeCache(isolate,
+                                         isolate->GetCurrentContext(), *source,
+                                         origin, path, &cache_key)
+      .ToLocal(script);
+}
+
+// Metrics entry points for native modules (see includes/tinn_metrics.h).
+// kind is 0 for counters, 1 for gauges and 2 for histograms.
+extern "C" TINN_EXPORT int tinn_MetricsRegister(const char* name, int kind) {
+  if (kind < v8::Metrics::kCounter || kind > v8::Metrics::kHistogram) {
+    return -1;
+  }
+  return v8::Metrics::Register(name, static_cast<v8::Metrics::Kind>(kind));
+}
+
+extern "C" TINN_EXPORT void tinn_MetricsAdd(int id, int64_t delta) {
+  v8::Metrics::Add(id, delta);
+}
+
+extern "C" TINN_EXPORT void tinn_MetricsSet(int id, int64_t value) {
+  v8::Metrics::Set(id, value);
+}
+
+extern "C" TINN_EXPORT void tinn_MetricsRecord(int id, int64_t value) {
+  v8::Metrics::Record(id, value);
+}
+
 #ifndef GOOGLE3
 int main(int argc, char* argv[]) {  
 	bool dontLoadModules = false;
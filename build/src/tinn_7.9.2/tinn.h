@@ -14,6 +14,7 @@ credits:
 #ifndef V8_D8_D8_H_
 #define V8_D8_D8_H_
 
+#include <atomic>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -203,21 +204,44 @@ class SerializationData {
   DISALLOW_COPY_AND_ASSIGN(SerializationData);
 };
 
+// Unbounded lock-free multi-producer/single-consumer queue (Vyukov's MPSC
+// algorithm). Enqueue can be called by any thread and never blocks; Dequeue
+// and DequeueWait must only be called by the thread that owns the queue.
+// The consumer parks on a semaphore which producers only signal when the
+// consumer is actually waiting, so a busy consumer costs no syscalls.
 class SerializationDataQueue {
  public:
+  SerializationDataQueue();
+  ~SerializationDataQueue();
+
   void Enqueue(std::unique_ptr<SerializationData> data);
   bool Dequeue(std::unique_ptr<SerializationData>* data);
+  // Waits up to timeout_ms milliseconds for a message, forever if timeout_ms
+  // is negative. Returns false on timeout.
+  bool DequeueWait(std::unique_ptr<SerializationData>* data,
+                   double timeout_ms);
   bool IsEmpty();
   void Clear();
+  size_t Size() { return size_.load(std::memory_order_relaxed); }
 
  private:
-  base::Mutex mutex_;
-  std::vector<std::unique_ptr<SerializationData>> data_;
+  struct Node {
+    std::atomic<Node*> next;
+    std::unique_ptr<SerializationData> data;
+  };
+
+  std::atomic<Node*> head_;  // last enqueued node, producers push here
+  Node* tail_;               // stub node, its successor is the next message
+  std::atomic<size_t> size_;
+  std::atomic<bool> waiting_;
+  base::Semaphore semaphore_;
+
+  DISALLOW_COPY_AND_ASSIGN(SerializationDataQueue);
 };
 
 class Worker {
  public:
-  explicit Worker(const char* script);
+  explicit Worker(const char* script, int batch_size = 0);
   ~Worker();
 
   // Post a message to the worker's incoming message queue. The worker will
@@ -228,8 +252,15 @@ class Worker {
   // If there is no message in the queue, block until a message is available.
   // If there are no messages in the queue and the worker is no longer running,
   // return nullptr.
+  // If timeout_ms is not negative, wait at most timeout_ms milliseconds and
+  // return nullptr if no message arrived in the meantime.
+  // This function should only be called by the thread that created the Worker.
+  std::unique_ptr<SerializationData> GetMessage(double timeout_ms = -1);
+  // Wait like GetMessage() for the first message, then move up to max - 1
+  // more of the already queued messages to out without blocking.
   // This function should only be called by the thread that created the Worker.
-  std::unique_ptr<SerializationData> GetMessage();
+  void GetMessages(size_t max, double timeout_ms,
+                   std::vector<std::unique_ptr<SerializationData>>* out);
   // Terminate the worker's event loop. Messages from the worker that have been
   // queued can still be read via GetMessage().
   // This function can be called by any thread.
@@ -257,12 +288,12 @@ class Worker {
   void ExecuteInThread();
   static void PostMessageOut(const v8::FunctionCallbackInfo<v8::Value>& args);
 
-  base::Semaphore in_semaphore_;
-  base::Semaphore out_semaphore_;
   SerializationDataQueue in_queue_;
   SerializationDataQueue out_queue_;
   base::Thread* thread_;
   char* script_;
+  // When > 0 onmessage is called with an array of up to batch_size_ messages.
+  int batch_size_;
   base::Atomic32 running_;
 };
 
@@ -352,6 +383,9 @@ class ShellOptions {
   bool disable_in_process_stack_traces = false;
   int read_from_tcp_port = -1;
   bool enable_os_system = false;
+  // Shared in-process code cache, persisted in code_cache_dir when set.
+  bool use_code_cache = true;
+  const char* code_cache_dir = nullptr;
   bool quiet_load = false;
   int thread_pool_size = 0;
   bool stress_delay_tasks = false;
@@ -376,6 +410,16 @@ class Shell : public i::AllStatic {
                             ReportExceptions report_exceptions,
                             ProcessMessageQueue process_message_queue);
   static bool ExecuteModule(Isolate* isolate, const char* file_name);
+  // Compiles source through the process-wide code cache. When a new cache
+  // entry was produced *cache_key is set, so callers can refresh it with
+  // UpdateCodeCache() after running the script.
+  static MaybeLocal<Script> CompileWithCodeCache(Isolate* isolate,
+                                                 Local<Context> context,
+                                                 Local<String> source,
+                                                 const ScriptOrigin& origin,
+                                                 const char* path,
+                                                 std::string* cache_key);
+  static void UpdateCodeCache(Local<Script> script, const std::string& key);
   static void ReportException(Isolate* isolate, TryCatch* try_catch);
   static Local<String> ReadFile(Isolate* isolate, const char* name);
   static Local<Context> CreateEvaluationContext(Isolate* isolate);
@@ -449,6 +493,8 @@ class Shell : public i::AllStatic {
   static void WorkerPostMessage(
       const v8::FunctionCallbackInfo<v8::Value>& args);
   static void WorkerGetMessage(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void WorkerGetMessages(
+      const v8::FunctionCallbackInfo<v8::Value>& args);
   static void WorkerTerminate(const v8::FunctionCallbackInfo<v8::Value>& args);
   // The OS object on the global object contains methods for performing
   // operating system calls:
@@ -500,6 +546,7 @@ class Shell : public i::AllStatic {
                            Local<ObjectTemplate> os_template);
 
   static void AddTINNOS(Isolate* isolate, v8::Local<v8::Context> &context);
+  static void AddTINNMetrics(Isolate* isolate, v8::Local<v8::Context> &context);
 
 						   
   static const char* kPrompt;
@@ -0,0 +1,116 @@
+// FastCGI serving benchmark for the README scenarios (hello world, generate
+// random file, serve static file). Workers serve on a UNIX socket and the
+// fcgi_bench load driver talks FastCGI to them directly, so no web server is
+// needed. Client side throughput/percentiles come from the driver, server side
+// timings (accept wait, handler, Http.finish) from Metrics.
+//
+//   make -C build/bench
+//   ./tinn examples/fcgi_benchmark.js [workers] [scale]
+//
+// scale multiplies the README request counts, e.g. 0.1 for a quick run.
+
+var threads = arguments.length > 0 ? parseInt(arguments[0]) : 20;
+var scale = arguments.length > 1 ? parseFloat(arguments[1]) : 1;
+var driver = 'build/bench/fcgi_bench';
+
+var scenarios = [
+	{name: 'hello world', uri: '/hello', requests: 100000, concurrency: 1},
+	{name: 'generate random file', uri: '/random', requests: 2000, concurrency: 50},
+	{name: 'serve static file', uri: '/index.html', requests: 100000, concurrency: 50},
+	{name: 'serve static file (serveFile)', uri: '/serve/index.html', requests: 100000, concurrency: 50}
+];
+
+// Worker body, same handlers as the README benchmarks
+function serve(dir) {
+	Metrics.setThreadName('http');
+	function respond(type, body) {
+		Http.print('Status: 200 OK\r\n');
+		Http.print('Content-type: ' + type + '\r\n');
+		Http.print('\r\n');
+		Http.print(body);
+	}
+	while (Http.accept()) {
+		var uri = Http.getParam('SCRIPT_NAME');
+		if (uri == '/hello') {
+			respond('text/html', 'Hello World!');
+		} else if (uri == '/random') {
+			var fname;
+			do {
+				fname = dir + '/' + (1 + Math.floor(Math.random() * 99999999)) + '.txt';
+			} while (os.isFileAndReadable(fname));
+			var payload = '';
+			for (var i = 0; i < 108000; i++) {
+				payload += String.fromCharCode(Math.floor(65 + (Math.random() * (122 - 65))));
+			}
+			os.writeFile(fname, payload);
+			var data = os.readFile(fname);
+			os.unlink(fname);
+			respond('text/plain', data);
+		} else if (uri == '/index.html') {
+			respond('text/html', os.readFile(dir + uri));
+		} else if (uri == '/serve/index.html') {
+			Http.serveFile(dir + '/index.html', 'text/html');
+		} else {
+			Http.print('Status: 404 Not Found\r\n\r\n');
+		}
+		Http.finish();
+	}
+}
+
+if (!os.isFileAndReadable(driver)) {
+	print(driver + ' not found, build it with: make -C build/bench');
+	quit(1);
+}
+
+var dir = '/tmp/tinn_fcgi_benchmark_' + Date.now();
+var sock = dir + '/tinn.sock';
+os.mkpath(dir);
+os.writeFile(dir + '/index.html', '<!DOCTYPE html>\n<html lang="en">\n<head>\n<meta charset="utf-8">\n' +
+	'<title></title>\n</head>\n<body>\nHello World\n</body>\n</html>\n');
+
+Http.openSocket(sock);
+for (var i = 0; i < threads; i++) {
+	new Worker('(' + serve.toString() + ')(' + JSON.stringify(dir) + ');', {type: 'string'});
+}
+print('Workers: ' + threads + ', socket: ' + sock + '\n');
+
+function ms(us) {
+	return (us / 1000).toFixed(2);
+}
+
+for (var s = 0; s < scenarios.length; s++) {
+	var sc = scenarios[s];
+	var n = Math.max(sc.concurrency, Math.round(sc.requests * scale));
+	Metrics.snapshot({reset: true});
+	var run = os.exec([driver, '-s', sock, '-n', String(n), '-c', String(sc.concurrency), '-u', sc.uri, '-j']);
+	var res;
+	try {
+		res = JSON.parse(run.output);
+	} catch (e) {
+		print(sc.name + ': driver failed: ' + run.output);
+		continue;
+	}
+	var h = Metrics.snapshot().histograms;
+	var wait = h['http.accept_wait_us'], handler = h['http.handler_us'], finish = h['http.finish_us'];
+	print(sc.name + ' (' + res.completed + ' requests, concurrency ' + sc.concurrency + ')');
+	print('  client:  ' + res.seconds.toFixed(2) + ' s, ' + res.rps.toFixed(1) + ' req/s, failed ' + (res.failed + res.non2xx) +
+		', ms p50 ' + res.p50Ms.toFixed(2) + ' p90 ' + res.p90Ms.toFixed(2) + ' p99 ' + res.p99Ms.toFixed(2) + ' max ' + res.maxMs.toFixed(2));
+	if (handler) {
+		print('  server:  handler ms p50 ' + ms(handler.p50) + ' p99 ' + ms(handler.p99) +
+			', finish ms p50 ' + ms(finish.p50) + ' p99 ' + ms(finish.p99) +
+			', accept wait ms p50 ' + ms(wait.p50));
+	}
+	print('');
+}
+
+var workers = Metrics.snapshot({workers: true}).workers;
+var perWorker = [];
+for (var i = 0; i < workers.length; i++) {
+	if (workers[i].name == 'http') perWorker.push(workers[i].counters['http.requests'] || 0);
+}
+print('requests per worker (last scenario): ' + perWorker.join(' '));
+
+Http.closeSocket();
+os.unlink(dir + '/index.html');
+os.unlink(sock);
+os.rmdir(dir);
@@ -11,4 +11,22 @@ hll = HyperLogLog.add(hll,  "string #10");
 
 var card = HyperLogLog.getCardinality(hll);
 
-print("the cardinality after adding 10 different string values is: " + card);
\ No newline at end of file
+print("the cardinality after adding 10 different string values is: " + card);
+// native sketches keep their registers in C++
+var visitors = new HyperLogLog.Sketch(14);
+visitors.add("user #1");
+visitors.addMany(["user #2", "user #3", "user #1"]);
+
+var other = HyperLogLog.create(14);
+for (var i=0; i<1000; i++) other.add("user #" + i);
+
+// serialize() returns a compact ArrayBuffer that can be stored as a binary value
+var buf = visitors.serialize();
+var restored = HyperLogLog.restore(buf);
+print("restored sketch (" + buf.byteLength + " bytes) cardinality: " + restored.cardinality());
+
+var union = HyperLogLog.mergeMany([restored, other.serialize()]);
+print("union cardinality: " + union.cardinality());
+
+// old array values are still readable
+print("legacy array restored: " + HyperLogLog.restore(hll).cardinality());
@@ -0,0 +1,68 @@
+// Compares single puts against batched writes and measures scan throughput.
+// usage: tinn examples/leveldb_benchmark.js [entries] [batchSize]
+
+var entries = parseInt(arguments[0] || '200000');
+var batchSize = parseInt(arguments[1] || '1000');
+var path = '/tmp/tinn_leveldb_benchmark';
+
+function pad(i) {
+	var s = '' + i;
+	while (s.length < 10) s = '0' + s;
+	return s;
+}
+
+function report(name, count, ms) {
+	print(name + ': ' + count + ' ops in ' + ms.toFixed(1) + ' ms (' + Math.round(count * 1000 / ms) + ' ops/sec)');
+}
+
+function openEmpty(name) {
+	os.system('rm -rf ' + path + '_' + name);
+	return LevelDB.open(path + '_' + name);
+}
+
+var value = 'x';
+while (value.length < 100) value += value;
+value = value.substring(0, 100);
+
+var db = openEmpty('single');
+var t = performance.now();
+for (var i = 0; i < entries; i++) {
+	LevelDB.put(db, 'bucket:' + pad(i), value);
+}
+report('single put', entries, performance.now() - t);
+LevelDB.close(db);
+
+db = openEmpty('batch');
+t = performance.now();
+for (var i = 0; i < entries; i += batchSize) {
+	var ops = [];
+	for (var j = i; j < i + batchSize && j < entries; j++) {
+		ops.push(['put', 'bucket:' + pad(j), value]);
+	}
+	LevelDB.write(db, ops);
+}
+report('batched put (' + batchSize + '/batch)', entries, performance.now() - t);
+
+[100, 1000, 10000].forEach(function(chunk) {
+	t = performance.now();
+	var it = LevelDB.iterator(db, {prefix: 'bucket:'});
+	var count = 0, res;
+	while ((res = LevelDB.next(it, chunk)).length > 0) count += res.length / 2;
+	LevelDB.closeIterator(it);
+	report('forward scan (' + chunk + '/chunk)', count, performance.now() - t);
+});
+
+t = performance.now();
+var it = LevelDB.iterator(db, {prefix: 'bucket:', reverse: true, values: false});
+var count = 0, res;
+while ((res = LevelDB.next(it, 1000)).length > 0) count += res.length;
+LevelDB.closeIterator(it);
+report('reverse key scan', count, performance.now() - t);
+
+var keys = [];
+for (var i = 0; i < 1000; i++) keys.push('bucket:' + pad(Math.floor(Math.random() * entries)));
+t = performance.now();
+for (var i = 0; i < 100; i++) LevelDB.multiGet(db, keys);
+report('multiGet (1000 keys/call)', 100 * keys.length, performance.now() - t);
+
+LevelDB.close(db);
@@ -0,0 +1,21 @@
+
+// Async logging: Log.* calls only queue the event, a background thread writes it.
+//
+//   ./tinn examples/log_async.js [events]
+
+var total = arguments.length > 0 ? parseInt(arguments[0]) : 100000;
+
+Log.init("examples/log_twologfiles.properties", {async: true, queueSize: 8192, overflow: 'count'});
+
+var t = performance.now();
+for (var i=0; i<total; i++) {
+	Log.info("async event " + i, "mylogger");
+	Log.debug("filtered out before the message is converted", "mylogger");
+}
+var queued = performance.now() - t;
+print("queued " + total + " events in " + queued.toFixed(1) + " ms");
+print("stats before flush: " + JSON.stringify(Log.getStats()));
+
+Log.flush();
+print("flushed after " + (performance.now() - t).toFixed(1) + " ms");
+print("stats after flush: " + JSON.stringify(Log.getStats()));
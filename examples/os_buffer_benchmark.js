@@ -0,0 +1,106 @@
+// Binary file I/O benchmark: the byte array functions (os.readBytes and
+// os.writeBytes) against the ArrayBuffer ones (readInto, readBuffer, pread,
+// readFileBuffer) and os.mmap, on a test file of the given size in MB.
+//
+//   ./tinn examples/os_buffer_benchmark.js [sizeMB] [byteArrayMB]
+//
+// The byte array path is so slow that it only processes the first
+// byteArrayMB (default 64) of the file; its MB/s is still comparable.
+
+var sizeMB = arguments.length > 0 ? parseInt(arguments[0]) : 1024;
+var byteArrayMB = Math.min(sizeMB, arguments.length > 1 ? parseInt(arguments[1]) : 64);
+var chunk = 1024 * 1024;
+var fname = '/tmp/tinn_os_buffer_benchmark_' + Date.now() + '.bin';
+
+function report(name, mb, ms, sum) {
+	print(name + ': ' + mb + ' MB in ' + ms.toFixed(1) + ' ms, ' + (mb * 1000 / ms).toFixed(1) + ' MB/s' +
+		(sum !== undefined ? ', checksum ' + sum : ''));
+}
+
+// the checksum keeps every path honest: all of them must touch every byte
+function checksum(bytes, sum) {
+	for (var i = 0; i < bytes.length; i += 4096) sum = (sum + bytes[i]) | 0;
+	return sum;
+}
+
+var block = new Uint8Array(chunk);
+for (var i = 0; i < chunk; i++) block[i] = (i * 31 + 7) & 0xff;
+
+// write
+var t = performance.now();
+var fd = os.fopen(fname, 'wb');
+for (var i = 0; i < sizeMB; i++) os.writeBuffer(fd, block);
+os.fclose(fd);
+report('writeBuffer', sizeMB, performance.now() - t);
+
+var blockArray = Array.prototype.slice.call(block);
+var tmpname = fname + '.bytes';
+t = performance.now();
+fd = os.fopen(tmpname, 'wb');
+for (var i = 0; i < byteArrayMB; i++) os.writeBytes(fd, blockArray);
+os.fclose(fd);
+report('writeBytes (byte array)', byteArrayMB, performance.now() - t);
+os.unlink(tmpname);
+
+// sequential reads
+t = performance.now();
+fd = os.fopen(fname, 'rb');
+var sum = 0;
+for (var i = 0; i < byteArrayMB; i++) sum = checksum(os.readBytes(fd, chunk), sum);
+os.fclose(fd);
+report('readBytes (byte array)', byteArrayMB, performance.now() - t, sum);
+
+t = performance.now();
+fd = os.fopen(fname, 'rb');
+var buf = new Uint8Array(chunk);
+sum = 0;
+for (var n; (n = os.readInto(fd, buf)) > 0; ) sum = checksum(n == chunk ? buf : buf.subarray(0, n), sum);
+os.fclose(fd);
+report('readInto', sizeMB, performance.now() - t, sum);
+
+t = performance.now();
+fd = os.fopen(fname, 'rb');
+sum = 0;
+for (var ab; (ab = os.readBuffer(fd, chunk)).byteLength > 0; ) sum = checksum(new Uint8Array(ab), sum);
+os.fclose(fd);
+report('readBuffer', sizeMB, performance.now() - t, sum);
+
+t = performance.now();
+fd = os.fopen(fname, 'rb');
+sum = 0;
+for (var pos = 0, n; (n = os.pread(fd, buf, pos)) > 0; pos += n) sum = checksum(n == chunk ? buf : buf.subarray(0, n), sum);
+os.fclose(fd);
+report('pread', sizeMB, performance.now() - t, sum);
+
+// whole file
+t = performance.now();
+var whole = os.readFileBuffer(fname);
+if (whole) {
+	report('readFileBuffer', sizeMB, performance.now() - t, checksum(new Uint8Array(whole), 0));
+	whole = null;
+} else {
+	print('readFileBuffer: could not load ' + sizeMB + ' MB');
+}
+
+t = performance.now();
+var mapped = os.mmap(fname);
+report('mmap', sizeMB, performance.now() - t, checksum(new Uint8Array(mapped), 0));
+os.munmap(mapped);
+
+// random access: 4 KB pages at pseudo random offsets
+var pages = 20000;
+var page = new Uint8Array(4096);
+var maxPage = sizeMB * 256;
+t = performance.now();
+fd = os.fopen(fname, 'rb');
+sum = 0;
+for (var i = 0, p = 1; i < pages; i++) {
+	p = (p * 1103515245 + 12345) & 0x7fffffff;
+	os.pread(fd, page, (p % maxPage) * 4096);
+	sum = (sum + page[0]) | 0;
+}
+os.fclose(fd);
+var ms = performance.now() - t;
+print('pread random 4 KB: ' + pages + ' pages in ' + ms.toFixed(1) + ' ms, ' + Math.round(pages * 1000 / ms) + ' pages/sec, checksum ' + sum);
+
+os.unlink(fname);
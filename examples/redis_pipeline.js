@@ -0,0 +1,15 @@
+function storeUser(user) {
+    var res = Redis.pipeline([
+        ['hmset', 'user:'+user.id, 'name', user.name, 'age', user.age],
+        ['expire', 'user:'+user.id, 60],
+        ['hgetall', 'user:'+user.id]
+    ]);
+    if (res[0] instanceof Error) throw res[0];
+    return res[2];
+}
+
+var fields = storeUser({id: 1, age: 20, name: 'Jorge Newman'});
+print("stored user: " + JSON.stringify(fields));
+
+var bin = Redis.pipeline([['get', 'user:1:avatar']], {binary: true})[0];
+print("avatar is " + (bin == null ? "missing" : bin.byteLength + " bytes"));
@@ -0,0 +1,101 @@
+// Worker messaging microbenchmark: messages/sec and round-trip latency with
+// 1, 4 and 32 echo Workers, plus batch mode and SharedChannel payloads.
+//
+//   ./tinn examples/worker_benchmark.js [messages]
+
+var total = arguments.length > 0 ? parseInt(arguments[0]) : 200000;
+var workerCounts = [1, 4, 32];
+
+var echoCode = 'onmessage = function(m) { postMessage(m); }';
+var batchEchoCode = 'onmessage = function(batch) { for (var i=0; i<batch.length; i++) postMessage(batch[i]); }';
+
+function report(name, n, ms) {
+	print(name + ": " + n + " msgs in " + ms.toFixed(1) + " ms, " + Math.round(n * 1000 / ms) + " msgs/sec");
+}
+
+function startWorkers(n, code, options) {
+	var workers = [];
+	options = options || {};
+	options.type = 'string';
+	for (var i=0; i<n; i++) workers.push(new Worker(code, options));
+	return workers;
+}
+
+function stopWorkers(workers) {
+	for (var i=0; i<workers.length; i++) workers[i].terminate();
+}
+
+// Post everything round-robin, then drain all replies with getMessages().
+function throughput(name, workers) {
+	var perWorker = Math.floor(total / workers.length);
+	var t = performance.now();
+	for (var i=0; i<perWorker; i++) {
+		for (var w=0; w<workers.length; w++) workers[w].postMessage(i);
+	}
+	var received = 0;
+	for (var w=0; w<workers.length; w++) {
+		var left = perWorker;
+		while (left > 0) {
+			var msgs = workers[w].getMessages(left, 1000);
+			if (msgs.length == 0) throw new Error("worker " + w + " stopped answering");
+			left -= msgs.length;
+		}
+		received += perWorker;
+	}
+	report(name, received, performance.now() - t);
+}
+
+// One message in flight per worker, timing each round trip.
+function latency(name, workers) {
+	var rounds = Math.min(10000, Math.floor(total / workers.length));
+	var samples = [];
+	for (var i=0; i<rounds; i++) {
+		var t = performance.now();
+		for (var w=0; w<workers.length; w++) workers[w].postMessage(i);
+		for (var w=0; w<workers.length; w++) workers[w].getMessage();
+		samples.push((performance.now() - t) * 1000);
+	}
+	samples.sort(function(a, b) { return a - b; });
+	function pct(p) { return samples[Math.min(samples.length - 1, Math.floor(samples.length * p))].toFixed(1); }
+	print(name + ": round trip us p50=" + pct(0.5) + " p99=" + pct(0.99) + " max=" + pct(1));
+}
+
+function sharedChannel(size) {
+	var count = Math.max(100, Math.floor(total / 100));
+	var payload = new Uint8Array(size);
+	var worker = new Worker(
+		'onmessage = function(buffer) {' +
+		'  var ch = new SharedChannel(buffer), n = 0, bytes = 0, m;' +
+		'  while ((m = ch.receive()).byteLength > 0) { n++; bytes += m.byteLength; }' +
+		'  postMessage([n, bytes]);' +
+		'}', {type: 'string'});
+	var ch = new SharedChannel(4 * 1024 * 1024);
+	worker.postMessage(ch.buffer);
+	var t = performance.now();
+	for (var i=0; i<count; i++) ch.send(payload);
+	ch.send(new Uint8Array(0));
+	worker.getMessage();
+	report("SharedChannel " + size + "B", count, performance.now() - t);
+	worker.terminate();
+
+	worker = startWorkers(1, echoCode)[0];
+	t = performance.now();
+	for (var i=0; i<count; i++) worker.postMessage(payload);
+	for (var i=0; i<count; i++) worker.getMessage();
+	report("postMessage   " + size + "B", count, performance.now() - t);
+	worker.terminate();
+}
+
+for (var c=0; c<workerCounts.length; c++) {
+	var n = workerCounts[c];
+	var workers = startWorkers(n, echoCode);
+	throughput(n + " workers", workers);
+	latency(n + " workers", workers);
+	stopWorkers(workers);
+
+	workers = startWorkers(n, batchEchoCode, {batch: 256});
+	throughput(n + " workers (batch: 256)", workers);
+	stopWorkers(workers);
+}
+
+sharedChannel(64 * 1024);